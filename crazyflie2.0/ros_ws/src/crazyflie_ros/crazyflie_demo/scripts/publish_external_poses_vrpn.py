@@ -0,0 +1,92 @@
+#!/usr/bin/env python
+
+# Publishes the vrpn poses of a whole swarm as one ExternalPoses message, so
+# the server can pack several vehicles into each broadcast packet.
+
+import threading
+
+import rospy
+from geometry_msgs.msg import PoseStamped
+from crazyflie_driver.msg import ExternalPoses
+from crazyflie_driver.srv import UpdateParams
+
+class Vehicle:
+    def __init__(self, frame, uri, prefix):
+        # the server matches the last byte of the address
+        self.id = int(uri[-2:], 16)
+        # tells vehicles with the same id on other channels apart
+        self.uri = uri
+        self.prefix = prefix
+        self.firstTransform = True
+        self.pose = None
+        rospy.wait_for_service(prefix + '/update_params')
+        rospy.loginfo("found " + prefix + "/update_params service")
+        self.update_params = rospy.ServiceProxy(prefix + '/update_params', UpdateParams)
+        rospy.Subscriber("/vrpn_client_node/" + frame + "/pose", PoseStamped, self.onNewTransform)
+
+    def onNewTransform(self, pose):
+        if self.firstTransform:
+            # initialize kalman filter
+            rospy.set_param(self.prefix + "/kalman/initialX", pose.pose.position.x)
+            rospy.set_param(self.prefix + "/kalman/initialY", pose.pose.position.y)
+            rospy.set_param(self.prefix + "/kalman/initialZ", pose.pose.position.z)
+            self.update_params(["kalman/initialX", "kalman/initialY", "kalman/initialZ"])
+
+            rospy.set_param(self.prefix + "/kalman/resetEstimation", 1)
+            self.update_params(["kalman/resetEstimation"])
+            self.firstTransform = False
+        else:
+            with lock:
+                self.pose = pose
+
+
+def publish(event):
+    global msg
+
+    msg.ids = []
+    msg.uris = []
+    msg.positions = []
+    msg.orientations = []
+    msg.header.stamp = rospy.Time(0)
+    with lock:
+        for vehicle in vehicles:
+            if vehicle.pose is None:
+                continue
+            msg.ids.append(vehicle.id)
+            msg.uris.append(vehicle.uri)
+            msg.positions.append(vehicle.pose.pose.position)
+            if send_orientation:
+                msg.orientations.append(vehicle.pose.pose.orientation)
+            msg.header.frame_id = vehicle.pose.header.frame_id
+            msg.header.stamp = max(msg.header.stamp, vehicle.pose.header.stamp)
+            # each pose is sent once
+            vehicle.pose = None
+    if msg.ids:
+        msg.header.seq += 1
+        pub.publish(msg)
+
+
+if __name__ == '__main__':
+    rospy.init_node('publish_external_poses_vrpn', anonymous=True)
+    frames = rospy.get_param("~frames", ["crazyflie1"])
+    uris = rospy.get_param("~uris", ["radio://0/80/2M/E7E7E7E701"])
+    prefixes = rospy.get_param("~prefixes", frames)
+    # poses are gathered over one period and sent together
+    rate = rospy.get_param("~rate", 100.0)
+    # the full pose lets the server use the bring-up packets
+    send_orientation = rospy.get_param("~send_orientation", False)
+
+    lock = threading.Lock()
+
+    msg = ExternalPoses()
+    msg.header.seq = 0
+    msg.header.stamp = rospy.Time.now()
+
+    pub = rospy.Publisher("/external_poses", ExternalPoses, queue_size=1)
+    vehicles = []
+    for frame, uri, prefix in zip(frames, uris, prefixes):
+        vehicles.append(Vehicle(frame, uri, "/" + prefix))
+
+    rospy.Timer(rospy.Duration(1.0 / rate), publish)
+
+    rospy.spin()
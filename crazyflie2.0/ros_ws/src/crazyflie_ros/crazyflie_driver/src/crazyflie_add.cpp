@@ -21,6 +21,8 @@ int main(int argc, char **argv)
   bool enable_logging_pressure;
   bool enable_logging_battery;
   bool enable_logging_packets;
+  double ping_rate;
+  bool force_no_cache;
 
   n.getParam("uri", uri);
   n.getParam("tf_prefix", tf_prefix);
@@ -35,6 +37,8 @@ int main(int argc, char **argv)
   n.param("enable_logging_pressure", enable_logging_pressure, true);
   n.param("enable_logging_battery", enable_logging_battery, true);
   n.param("enable_logging_packets", enable_logging_packets, true);
+  n.param("ping_rate", ping_rate, 1000.0);
+  n.param("force_no_cache", force_no_cache, false);
 
 
   ROS_INFO("wait_for_service /add_crazyflie");
@@ -55,6 +59,8 @@ int main(int argc, char **argv)
   addCrazyflie.request.enable_logging_pressure = enable_logging_pressure;
   addCrazyflie.request.enable_logging_battery = enable_logging_battery;
   addCrazyflie.request.enable_logging_packets = enable_logging_packets;
+  addCrazyflie.request.ping_rate = ping_rate;
+  addCrazyflie.request.force_no_cache = force_no_cache;
 
   std::vector<std::string> genericLogTopics;
   n.param("genericLogTopics", genericLogTopics, std::vector<std::string>());
@@ -13,6 +13,7 @@
 #include "crazyflie_driver/UploadTrajectory.h"
 #include "crazyflie_driver/sendPacket.h"
 
+#include "crazyflie_driver/ExternalPoses.h"
 #include "crazyflie_driver/LogBlock.h"
 #include "crazyflie_driver/GenericLogData.h"
 #include "crazyflie_driver/FullState.h"
@@ -32,11 +33,19 @@
 #include "std_msgs/Float32.h"
 
 //#include <regex>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
 #include <thread>
 #include <mutex>
 
 #include <string>
 #include <map>
+#include <memory>
+#include <vector>
 
 #include <crazyflie_cpp/Crazyflie.h>
 
@@ -78,6 +87,157 @@ public:
 
 static ROSLogger rosLogger;
 
+// vehicles on the same Crazyradio share its scheduler; other links
+// (e.g. usb://) get one each
+static std::string radioOf(const std::string& link_uri)
+{
+  if (link_uri.compare(0, 8, "radio://") == 0) {
+    size_t end = link_uri.find('/', 8);
+    return link_uri.substr(0, end);
+  }
+  return link_uri;
+}
+
+// Broadcasts reach every vehicle on the same channel and datarate, e.g.
+// radio://0/80/2M/E7E7E7E701 -> radio://0/80/2M/FFE7E7E7E7. Returns an
+// empty string for links that cannot broadcast.
+static std::string broadcastUriOf(const std::string& link_uri)
+{
+  if (link_uri.compare(0, 8, "radio://") != 0) {
+    return std::string();
+  }
+  size_t end = link_uri.rfind('/');
+  if (end < 8 || link_uri.size() - end - 1 != 10) {
+    return std::string();
+  }
+  return link_uri.substr(0, end) + "/FFE7E7E7E7";
+}
+
+// the id the firmware matches packed positions against: the last byte of
+// the radio address; -1 if there is none
+static int broadcastIdOf(const std::string& link_uri)
+{
+  if (broadcastUriOf(link_uri).empty()) {
+    return -1;
+  }
+  return std::stoi(link_uri.substr(link_uri.size() - 2), nullptr, 16);
+}
+
+class CrazyflieROS;
+
+// Owns one Crazyradio: a single worker thread serves every vehicle on it in
+// rounds. Each round gives every vehicle one slot per priority class, in
+// order: setpoints, then external positions, then the pings that stream
+// logging data out. Services run on the server's service threads instead;
+// a vehicle in a service call sits out the rounds until it returns.
+// Vehicles are added once they are connected.
+class RadioScheduler
+{
+public:
+  RadioScheduler(const std::string& radio);
+  ~RadioScheduler();
+
+  void add(CrazyflieROS* cf);
+
+  // waits until the vehicle was shut down, if it was added
+  void remove(CrazyflieROS* cf);
+
+  // something was queued for one of the vehicles
+  void notify();
+
+  // Poses of several vehicles from one mocap frame, sent in the external
+  // position slot of the next round. A frame that was not sent yet is
+  // replaced. The vectors are swapped with empty ones.
+  void broadcastExternalPositions(
+    const std::string& broadcastUri,
+    std::vector<CrazyflieBroadcaster::externalPosition>& positions);
+  void broadcastExternalPoses(
+    const std::string& broadcastUri,
+    std::vector<CrazyflieBroadcaster::stateExternalBringup>& poses);
+
+  typedef std::function<void(CrazyflieBroadcaster&)> BroadcastCommand;
+
+  // Sends a high-level command to the given broadcast addresses at the
+  // start of the next round, before any other command. Broadcasts are not
+  // acknowledged, so it goes out `repeats` times back to back; the copies
+  // arrive within a few milliseconds and the firmware plans them from the
+  // same state. The future is ready once all copies were sent.
+  std::future<void> broadcastCommand(
+    const std::vector<std::string>& broadcastUris,
+    const BroadcastCommand& command,
+    int repeats);
+
+private:
+  void run();
+
+  struct PendingCommand
+  {
+    std::vector<CrazyflieBroadcaster*> broadcasters;
+    BroadcastCommand command;
+    int repeats;
+    std::promise<void> sent;
+  };
+
+  struct Broadcast
+  {
+    Broadcast(const std::string& uri)
+      : broadcaster(new CrazyflieBroadcaster(uri))
+      , positions()
+      , poses()
+      , sendPositions()
+      , sendPoses()
+    {
+    }
+
+    std::unique_ptr<CrazyflieBroadcaster> broadcaster;
+    // guarded by m_mutex
+    std::vector<CrazyflieBroadcaster::externalPosition> positions;
+    std::vector<CrazyflieBroadcaster::stateExternalBringup> poses;
+    // used by the worker only
+    std::vector<CrazyflieBroadcaster::externalPosition> sendPositions;
+    std::vector<CrazyflieBroadcaster::stateExternalBringup> sendPoses;
+  };
+
+  // with m_mutex held
+  Broadcast& broadcast(const std::string& broadcastUri);
+
+private:
+  std::string m_radio;
+  std::mutex m_mutex;
+  std::condition_variable m_wakeUp;
+  std::condition_variable m_removed;
+  // guarded by m_mutex
+  std::vector<CrazyflieROS*> m_vehicles;
+  bool m_pending;
+  bool m_running;
+  // first vehicle of the next round
+  size_t m_round;
+  // by broadcast uri; never removed while the worker runs
+  std::map<std::string, Broadcast> m_broadcasts;
+  std::vector<std::unique_ptr<PendingCommand> > m_commands;
+  std::thread m_thread;
+};
+
+// wakes up the scheduler of the radio whenever a callback is queued
+class SchedulerCallbackQueue : public ros::CallbackQueue
+{
+public:
+  SchedulerCallbackQueue(RadioScheduler& scheduler)
+    : ros::CallbackQueue()
+    , m_scheduler(scheduler)
+  {
+  }
+
+  virtual void addCallback(const ros::CallbackInterfacePtr& callback, uint64_t owner_id = 0)
+  {
+    ros::CallbackQueue::addCallback(callback, owner_id);
+    m_scheduler.notify();
+  }
+
+private:
+  RadioScheduler& m_scheduler;
+};
+
 class CrazyflieROS
 {
 public:
@@ -95,7 +255,11 @@ public:
     bool enable_logging_magnetic_field,
     bool enable_logging_pressure,
     bool enable_logging_battery,
-    bool enable_logging_packets)
+    bool enable_logging_packets,
+    float ping_rate,
+    bool force_no_cache,
+    RadioScheduler& scheduler,
+    ros::CallbackQueue& serviceQueue)
     : m_cf(link_uri, rosLogger)
     , m_tf_prefix(tf_prefix)
     , m_isEmergency(false)
@@ -111,6 +275,8 @@ public:
     , m_enable_logging_pressure(enable_logging_pressure)
     , m_enable_logging_battery(enable_logging_battery)
     , m_enable_logging_packets(enable_logging_packets)
+    , m_pingPeriod(std::chrono::microseconds((int64_t)(1e6 / (ping_rate > 0 ? ping_rate : 1000))))
+    , m_forceNoCache(force_no_cache)
     , m_serviceEmergency()
     , m_serviceUpdateParams()
     , m_serviceSetGroupMask()
@@ -132,10 +298,23 @@ public:
     , m_pubPressure()
     , m_pubBattery()
     , m_pubRssi()
+    , m_pubCommandLatency()
+    , m_logBlockImu()
+    , m_logBlock2()
+    , m_logBlocksGeneric()
     , m_sentSetpoint(false)
     , m_sentExternalPosition(false)
+    , m_commandLatencySum(0)
+    , m_commandLatencyMax(0)
+    , m_commandLatencyCount(0)
+    , m_scheduler(scheduler)
+    , m_linkMutex()
+    , m_thread()
+    , m_callback_queue(scheduler)
+    , m_externalPositionQueue(scheduler)
+    , m_serviceQueue(serviceQueue)
   {
-    m_thread = std::thread(&CrazyflieROS::run, this);
+    m_thread = std::thread(&CrazyflieROS::connect, this);
   }
 
   void stop()
@@ -143,6 +322,77 @@ public:
     ROS_INFO("Disconnecting ...");
     m_isEmergency = true;
     m_thread.join();
+    m_scheduler.remove(this);
+  }
+
+  // Called by the scheduler of the radio
+
+  bool isEmergency() const
+  {
+    return m_isEmergency;
+  }
+
+  // false while a service call uses the link; the vehicle sits out the round
+  bool tryLockLink()
+  {
+    return m_linkMutex.try_lock();
+  }
+
+  void unlockLink()
+  {
+    m_linkMutex.unlock();
+  }
+
+  // one queued setpoint; returns false if there was none
+  bool runCommand()
+  {
+    return m_callback_queue.callOne(ros::WallDuration(0.0)) == ros::CallbackQueue::Called;
+  }
+
+  // one queued external position; returns false if there was none
+  bool runExternalPosition()
+  {
+    return m_externalPositionQueue.callOne(ros::WallDuration(0.0)) == ros::CallbackQueue::Called;
+  }
+
+  // pings and reports that are due
+  void serviceLink(std::chrono::steady_clock::time_point now)
+  {
+    if (m_enableLogging && now >= m_nextPing) {
+      // make sure we ping often enough to stream data out; the acks of
+      // commands sent in the meantime did that already
+      if (!m_sentSetpoint && !m_sentExternalPosition) {
+        m_cf.transmitPackets();
+        m_cf.sendPing();
+        if(m_enable_logging_packets) {
+          this->publishPackets();
+        }
+      }
+      m_sentSetpoint = false;
+      m_sentExternalPosition = false;
+      m_nextPing = std::max(m_nextPing + m_pingPeriod, now);
+    }
+    if (now >= m_nextReport) {
+      reportCommandLatency();
+      m_nextReport += std::chrono::seconds(1);
+    }
+  }
+
+  // when serviceLink() has something to do next
+  std::chrono::steady_clock::time_point nextDeadline() const
+  {
+    if (m_enableLogging) {
+      return std::min(m_nextPing, m_nextReport);
+    }
+    return m_nextReport;
+  }
+
+  void shutdown()
+  {
+    // Make sure we turn the engines off
+    for (int i = 0; i < 100; ++i) {
+       m_cf.sendSetpoint(0, 0, 0, 0);
+    }
   }
 
   /**
@@ -155,6 +405,10 @@ public:
     crazyflie_driver::sendPacket::Request &req,
     crazyflie_driver::sendPacket::Response &res)
   {
+    ServiceLock lock(*this);
+    if (!lock) {
+      return false;
+    }
     /** Convert the message struct to the packet struct */
     crtpPacket_t packet;
     packet.size = req.packet.size;
@@ -212,12 +466,41 @@ private:
   } __attribute__((packed));
 
 private:
+  // Taken by service calls, which run on the server's shared service
+  // threads, while they use the link; false once in emergency, so the
+  // vehicle gets no more commands.
+  class ServiceLock
+  {
+  public:
+    explicit ServiceLock(CrazyflieROS& vehicle)
+      : m_vehicle(vehicle)
+    {
+      m_vehicle.m_linkMutex.lock();
+    }
+
+    ~ServiceLock()
+    {
+      m_vehicle.m_linkMutex.unlock();
+      // setpoints may have waited for the link
+      m_vehicle.m_scheduler.notify();
+    }
+
+    explicit operator bool() const
+    {
+      return !m_vehicle.m_isEmergency;
+    }
+
+  private:
+    CrazyflieROS& m_vehicle;
+  };
+
   bool emergency(
     std_srvs::Empty::Request& req,
     std_srvs::Empty::Response& res)
   {
     ROS_FATAL("Emergency requested!");
     m_isEmergency = true;
+    m_scheduler.notify();
 
     return true;
   }
@@ -229,11 +512,40 @@ private:
       m_cf.setParam<T>(id, (T)value);
   }
 
+  // from the message arriving at this node until its packet was sent
+  void recordCommandLatency(const ros::Time& receiptTime)
+  {
+    double latency = (ros::Time::now() - receiptTime).toSec();
+    m_commandLatencySum += latency;
+    m_commandLatencyMax = std::max(m_commandLatencyMax, latency);
+    ++m_commandLatencyCount;
+  }
+
+  void reportCommandLatency()
+  {
+    if (m_commandLatencyCount == 0) {
+      return;
+    }
+    std_msgs::Float32 msg;
+    // s
+    msg.data = m_commandLatencySum / m_commandLatencyCount;
+    m_pubCommandLatency.publish(msg);
+    ROS_DEBUG("%s: %zu commands, latency mean %f ms, max %f ms",
+      m_tf_prefix.c_str(),
+      m_commandLatencyCount,
+      1e3 * msg.data,
+      1e3 * m_commandLatencyMax);
+    m_commandLatencySum = 0;
+    m_commandLatencyMax = 0;
+    m_commandLatencyCount = 0;
+  }
+
 void cmdHoverSetpoint(
-    const crazyflie_driver::Hover::ConstPtr& msg)
+    const ros::MessageEvent<const crazyflie_driver::Hover>& event)
   {
      //ROS_INFO("got a hover setpoint");
     if (!m_isEmergency) {
+      const crazyflie_driver::Hover::ConstPtr& msg = event.getMessage();
       float vx = msg->vx;
       float vy = msg->vy;
       float yawRate = msg->yawrate;
@@ -241,25 +553,28 @@ void cmdHoverSetpoint(
 
       m_cf.sendHoverSetpoint(vx, vy, yawRate, zDistance);
       m_sentSetpoint = true;
+      recordCommandLatency(event.getReceiptTime());
       //ROS_INFO("set a hover setpoint");
     }
   }
 
 void cmdStop(
-    const std_msgs::Empty::ConstPtr& msg)
+    const ros::MessageEvent<const std_msgs::Empty>& event)
   {
      //ROS_INFO("got a stop setpoint");
     if (!m_isEmergency) {
       m_cf.sendStop();
       m_sentSetpoint = true;
+      recordCommandLatency(event.getReceiptTime());
       //ROS_INFO("set a stop setpoint");
     }
   }
 
 void cmdPositionSetpoint(
-    const crazyflie_driver::Position::ConstPtr& msg)
+    const ros::MessageEvent<const crazyflie_driver::Position>& event)
   {
     if(!m_isEmergency) {
+      const crazyflie_driver::Position::ConstPtr& msg = event.getMessage();
       float x = msg->x;
       float y = msg->y;
       float z = msg->z;
@@ -267,6 +582,7 @@ void cmdPositionSetpoint(
 
       m_cf.sendPositionSetpoint(x, y, z, yaw);
       m_sentSetpoint = true;
+      recordCommandLatency(event.getReceiptTime());
     }
   }
 
@@ -275,6 +591,10 @@ void cmdPositionSetpoint(
     crazyflie_driver::UpdateParams::Response& res)
   {
     ROS_INFO("Update parameters");
+    ServiceLock lock(*this);
+    if (!lock) {
+      return false;
+    }
     for (auto&& p : req.params) {
       std::string ros_param = "/" + m_tf_prefix + "/" + p;
       size_t pos = p.find("/");
@@ -316,9 +636,10 @@ void cmdPositionSetpoint(
   }
 
   void cmdVelChanged(
-    const geometry_msgs::Twist::ConstPtr& msg)
+    const ros::MessageEvent<const geometry_msgs::Twist>& event)
   {
     if (!m_isEmergency) {
+      const geometry_msgs::Twist::ConstPtr& msg = event.getMessage();
       float roll = msg->linear.y + m_roll_trim;
       float pitch = - (msg->linear.x + m_pitch_trim);
       float yawrate = msg->angular.z;
@@ -326,14 +647,16 @@ void cmdPositionSetpoint(
 
       m_cf.sendSetpoint(roll, pitch, yawrate, thrust);
       m_sentSetpoint = true;
+      recordCommandLatency(event.getReceiptTime());
     }
   }
 
   void cmdFullStateSetpoint(
-    const crazyflie_driver::FullState::ConstPtr& msg)
+    const ros::MessageEvent<const crazyflie_driver::FullState>& event)
   {
     //ROS_INFO("got a full state setpoint");
     if (!m_isEmergency) {
+      const crazyflie_driver::FullState::ConstPtr& msg = event.getMessage();
       float x = msg->pose.position.x;
       float y = msg->pose.position.y;
       float z = msg->pose.position.z;
@@ -359,39 +682,40 @@ void cmdPositionSetpoint(
         qx, qy, qz, qw,
         rollRate, pitchRate, yawRate);
       m_sentSetpoint = true;
+      recordCommandLatency(event.getReceiptTime());
       //ROS_INFO("set a full state setpoint");
     }
   }
 
   void positionMeasurementChanged(
-    const geometry_msgs::PointStamped::ConstPtr& msg)
+    const ros::MessageEvent<const geometry_msgs::PointStamped>& event)
   {
+    const geometry_msgs::PointStamped::ConstPtr& msg = event.getMessage();
     m_cf.sendExternalPositionUpdate(msg->point.x, msg->point.y, msg->point.z);
     m_sentExternalPosition = true;
+    recordCommandLatency(event.getReceiptTime());
   }
 
-  void run()
+  // brings up the connection, then hands the vehicle to the scheduler
+  void connect()
   {
     ros::NodeHandle n;
     n.setCallbackQueue(&m_callback_queue);
+    // services, except emergency, are advertised once the link is up
+    ros::NodeHandle nServices;
+    nServices.setCallbackQueue(&m_serviceQueue);
+    ros::NodeHandle nExternalPosition;
+    nExternalPosition.setCallbackQueue(&m_externalPositionQueue);
 
     m_subscribeCmdVel = n.subscribe(m_tf_prefix + "/cmd_vel", 1, &CrazyflieROS::cmdVelChanged, this);
     m_subscribeCmdFullState = n.subscribe(m_tf_prefix + "/cmd_full_state", 1, &CrazyflieROS::cmdFullStateSetpoint, this);
-    m_subscribeExternalPosition = n.subscribe(m_tf_prefix + "/external_position", 1, &CrazyflieROS::positionMeasurementChanged, this);
-    m_serviceEmergency = n.advertiseService(m_tf_prefix + "/emergency", &CrazyflieROS::emergency, this);
+    m_subscribeExternalPosition = nExternalPosition.subscribe(m_tf_prefix + "/external_position", 1, &CrazyflieROS::positionMeasurementChanged, this);
+    m_serviceEmergency = nServices.advertiseService(m_tf_prefix + "/emergency", &CrazyflieROS::emergency, this);
     m_subscribeCmdHover = n.subscribe(m_tf_prefix + "/cmd_hover", 1, &CrazyflieROS::cmdHoverSetpoint, this);
     m_subscribeCmdStop = n.subscribe(m_tf_prefix + "/cmd_stop", 1, &CrazyflieROS::cmdStop, this);
     m_subscribeCmdPosition = n.subscribe(m_tf_prefix + "/cmd_position", 1, &CrazyflieROS::cmdPositionSetpoint, this);
 
 
-    m_serviceSetGroupMask = n.advertiseService(m_tf_prefix + "/set_group_mask", &CrazyflieROS::setGroupMask, this);
-    m_serviceTakeoff = n.advertiseService(m_tf_prefix + "/takeoff", &CrazyflieROS::takeoff, this);
-    m_serviceLand = n.advertiseService(m_tf_prefix + "/land", &CrazyflieROS::land, this);
-    m_serviceStop = n.advertiseService(m_tf_prefix + "/stop", &CrazyflieROS::stop, this);
-    m_serviceGoTo = n.advertiseService(m_tf_prefix + "/go_to", &CrazyflieROS::goTo, this);
-    m_serviceUploadTrajectory = n.advertiseService(m_tf_prefix + "/upload_trajectory", &CrazyflieROS::uploadTrajectory, this);
-    m_serviceStartTrajectory = n.advertiseService(m_tf_prefix + "/start_trajectory", &CrazyflieROS::startTrajectory, this);
-
     if (m_enable_logging_imu) {
       m_pubImu = n.advertise<sensor_msgs::Imu>(m_tf_prefix + "/imu", 10);
     }
@@ -411,17 +735,16 @@ void cmdPositionSetpoint(
       m_pubPackets = n.advertise<crazyflie_driver::crtpPacket>(m_tf_prefix + "/packets", 10);
     }
     m_pubRssi = n.advertise<std_msgs::Float32>(m_tf_prefix + "/rssi", 10);
+    m_pubCommandLatency = n.advertise<std_msgs::Float32>(m_tf_prefix + "/command_latency", 10);
 
     for (auto& logBlock : m_logBlocks)
     {
       m_pubLogDataGeneric.push_back(n.advertise<crazyflie_driver::GenericLogData>(m_tf_prefix + "/" + logBlock.topic_name, 10));
     }
 
-    m_sendPacketServer = n.advertiseService(m_tf_prefix + "/send_packet"  , &CrazyflieROS::sendPacket, this);
-
     // m_cf.reboot();
 
-    auto start = std::chrono::system_clock::now();
+    auto start = std::chrono::steady_clock::now();
 
     std::function<void(const char*)> cb_console = std::bind(&CrazyflieROS::onConsole, this, std::placeholders::_1);
     m_cf.setConsoleCallback(cb_console);
@@ -433,55 +756,82 @@ void cmdPositionSetpoint(
 
 
 
+    // The TOCs are cached on disk by crazyflie_cpp, keyed by their CRC, in
+    // the working directory of the server ($ROS_HOME); a vehicle with known
+    // firmware only transfers the parameter values.
+    std::future<void> mirrorParams;
+    std::chrono::duration<double> paramSeconds(0);
     if (m_enableParameters)
     {
       ROS_INFO("Requesting parameters...");
-      m_cf.requestParamToc();
+      auto paramStart = std::chrono::steady_clock::now();
+      m_cf.requestParamToc(m_forceNoCache);
+      paramSeconds = std::chrono::steady_clock::now() - paramStart;
+
+      // one parameter server call per group instead of per parameter
+      std::map<std::string, XmlRpc::XmlRpcValue> groups;
       for (auto iter = m_cf.paramsBegin(); iter != m_cf.paramsEnd(); ++iter) {
         auto entry = *iter;
-        std::string paramName = "/" + m_tf_prefix + "/" + entry.group + "/" + entry.name;
+        XmlRpc::XmlRpcValue& value = groups[entry.group][entry.name];
         switch (entry.type) {
           case Crazyflie::ParamTypeUint8:
-            ros::param::set(paramName, m_cf.getParam<uint8_t>(entry.id));
+            value = (int)m_cf.getParam<uint8_t>(entry.id);
             break;
           case Crazyflie::ParamTypeInt8:
-            ros::param::set(paramName, m_cf.getParam<int8_t>(entry.id));
+            value = (int)m_cf.getParam<int8_t>(entry.id);
             break;
           case Crazyflie::ParamTypeUint16:
-            ros::param::set(paramName, m_cf.getParam<uint16_t>(entry.id));
+            value = (int)m_cf.getParam<uint16_t>(entry.id);
             break;
           case Crazyflie::ParamTypeInt16:
-            ros::param::set(paramName, m_cf.getParam<int16_t>(entry.id));
+            value = (int)m_cf.getParam<int16_t>(entry.id);
             break;
           case Crazyflie::ParamTypeUint32:
-            ros::param::set(paramName, (int)m_cf.getParam<uint32_t>(entry.id));
+            value = (int)m_cf.getParam<uint32_t>(entry.id);
             break;
           case Crazyflie::ParamTypeInt32:
-            ros::param::set(paramName, m_cf.getParam<int32_t>(entry.id));
+            value = (int)m_cf.getParam<int32_t>(entry.id);
             break;
           case Crazyflie::ParamTypeFloat:
-            ros::param::set(paramName, m_cf.getParam<float>(entry.id));
+            value = (double)m_cf.getParam<float>(entry.id);
             break;
         }
       }
-      m_serviceUpdateParams = n.advertiseService(m_tf_prefix + "/update_params", &CrazyflieROS::updateParams, this);
+      // talks to the master only, so it overlaps with the log setup; merged
+      // into each group's namespace, so keys that are not firmware
+      // parameters survive as they did with one call per parameter
+      std::string prefix = "/" + m_tf_prefix + "/";
+      mirrorParams = std::async(std::launch::async, [prefix, groups]() mutable {
+        for (auto& group : groups) {
+          XmlRpc::XmlRpcValue merged;
+          if (ros::param::get(prefix + group.first, merged)
+              && merged.getType() == XmlRpc::XmlRpcValue::TypeStruct) {
+            for (auto it = group.second.begin(); it != group.second.end(); ++it) {
+              merged[it->first] = it->second;
+            }
+            ros::param::set(prefix + group.first, merged);
+          } else {
+            ros::param::set(prefix + group.first, group.second);
+          }
+        }
+      });
     }
 
-    std::unique_ptr<LogBlock<logImu> > logBlockImu;
-    std::unique_ptr<LogBlock<log2> > logBlock2;
-    std::vector<std::unique_ptr<LogBlockGeneric> > logBlocksGeneric(m_logBlocks.size());
+    m_logBlocksGeneric.resize(m_logBlocks.size());
+    std::chrono::duration<double> logSeconds(0);
     if (m_enableLogging) {
+      auto logStart = std::chrono::steady_clock::now();
 
       std::function<void(const crtpPlatformRSSIAck*)> cb_ack = std::bind(&CrazyflieROS::onEmptyAck, this, std::placeholders::_1);
       m_cf.setEmptyAckCallback(cb_ack);
 
       ROS_INFO("Requesting Logging variables...");
-      m_cf.requestLogToc();
+      m_cf.requestLogToc(m_forceNoCache);
 
       if (m_enable_logging_imu) {
         std::function<void(uint32_t, logImu*)> cb = std::bind(&CrazyflieROS::onImuData, this, std::placeholders::_1, std::placeholders::_2);
 
-        logBlockImu.reset(new LogBlock<logImu>(
+        m_logBlockImu.reset(new LogBlock<logImu>(
           &m_cf,{
             {"acc", "x"},
             {"acc", "y"},
@@ -490,7 +840,7 @@ void cmdPositionSetpoint(
             {"gyro", "y"},
             {"gyro", "z"},
           }, cb));
-        logBlockImu->start(1); // 10ms
+        m_logBlockImu->start(1); // 10ms
       }
 
       if (   m_enable_logging_temperature
@@ -500,7 +850,7 @@ void cmdPositionSetpoint(
       {
         std::function<void(uint32_t, log2*)> cb2 = std::bind(&CrazyflieROS::onLog2Data, this, std::placeholders::_1, std::placeholders::_2);
 
-        logBlock2.reset(new LogBlock<log2>(
+        m_logBlock2.reset(new LogBlock<log2>(
           &m_cf,{
             {"mag", "x"},
             {"mag", "y"},
@@ -509,7 +859,7 @@ void cmdPositionSetpoint(
             {"baro", "pressure"},
             {"pm", "vbat"},
           }, cb2));
-        logBlock2->start(10); // 100ms
+        m_logBlock2->start(10); // 100ms
       }
 
       // custom log blocks
@@ -524,53 +874,60 @@ void cmdPositionSetpoint(
             std::placeholders::_2,
             std::placeholders::_3);
 
-        logBlocksGeneric[i].reset(new LogBlockGeneric(
+        m_logBlocksGeneric[i].reset(new LogBlockGeneric(
           &m_cf,
           logBlock.variables,
           (void*)&m_pubLogDataGeneric[i],
           cb));
-        logBlocksGeneric[i]->start(logBlock.frequency / 10);
+        m_logBlocksGeneric[i]->start(logBlock.frequency / 10);
         ++i;
       }
 
-
+      logSeconds = std::chrono::steady_clock::now() - logStart;
     }
 
+    // needed for trajectory uploads; fetched here, so the first upload does
+    // not hold up the link
     ROS_INFO("Requesting memories...");
     m_cf.requestMemoryToc();
 
+    if (mirrorParams.valid()) {
+      mirrorParams.get();
+    }
+
     ROS_INFO("Ready...");
-    auto end = std::chrono::system_clock::now();
+    auto end = std::chrono::steady_clock::now();
     std::chrono::duration<double> elapsedSeconds = end-start;
-    ROS_INFO("Elapsed: %f s", elapsedSeconds.count());
+    ROS_INFO("Elapsed: %f s (parameters: %f s, logging: %f s)",
+      elapsedSeconds.count(), paramSeconds.count(), logSeconds.count());
 
     // Send 0 thrust initially for thrust-lock
     for (int i = 0; i < 100; ++i) {
        m_cf.sendSetpoint(0, 0, 0, 0);
     }
 
-    while(!m_isEmergency) {
-      // make sure we ping often enough to stream data out
-      if (m_enableLogging && !m_sentSetpoint && !m_sentExternalPosition) {
-        m_cf.transmitPackets();
-        m_cf.sendPing();
-        if(m_enable_logging_packets) {
-          this->publishPackets();
-        }
-      }
-      m_sentSetpoint = false;
-      m_sentExternalPosition = false;
-
-      // Execute any ROS related functions now
-      m_callback_queue.callAvailable(ros::WallDuration(0.0));
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (m_isEmergency) {
+      shutdown();
+      return;
     }
 
-    // Make sure we turn the engines off
-    for (int i = 0; i < 100; ++i) {
-       m_cf.sendSetpoint(0, 0, 0, 0);
+    m_serviceSetGroupMask = nServices.advertiseService(m_tf_prefix + "/set_group_mask", &CrazyflieROS::setGroupMask, this);
+    m_serviceTakeoff = nServices.advertiseService(m_tf_prefix + "/takeoff", &CrazyflieROS::takeoff, this);
+    m_serviceLand = nServices.advertiseService(m_tf_prefix + "/land", &CrazyflieROS::land, this);
+    m_serviceStop = nServices.advertiseService(m_tf_prefix + "/stop", &CrazyflieROS::stop, this);
+    m_serviceGoTo = nServices.advertiseService(m_tf_prefix + "/go_to", &CrazyflieROS::goTo, this);
+    m_serviceUploadTrajectory = nServices.advertiseService(m_tf_prefix + "/upload_trajectory", &CrazyflieROS::uploadTrajectory, this);
+    m_serviceStartTrajectory = nServices.advertiseService(m_tf_prefix + "/start_trajectory", &CrazyflieROS::startTrajectory, this);
+    m_sendPacketServer = nServices.advertiseService(m_tf_prefix + "/send_packet", &CrazyflieROS::sendPacket, this);
+    if (m_enableParameters) {
+      m_serviceUpdateParams = nServices.advertiseService(m_tf_prefix + "/update_params", &CrazyflieROS::updateParams, this);
     }
 
+    // Commands are sent from their callbacks as soon as the scheduler gets
+    // to them; in between, it sleeps until the next ping is due
+    m_nextPing = std::chrono::steady_clock::now();
+    m_nextReport = m_nextPing + std::chrono::seconds(1);
+    m_scheduler.add(this);
   }
 
   void onImuData(uint32_t time_in_ms, logImu* data) {
@@ -682,6 +1039,10 @@ void cmdPositionSetpoint(
     crazyflie_driver::SetGroupMask::Response& res)
   {
     ROS_INFO("SetGroupMask requested");
+    ServiceLock lock(*this);
+    if (!lock) {
+      return false;
+    }
     m_cf.setGroupMask(req.groupMask);
     return true;
   }
@@ -691,6 +1052,10 @@ void cmdPositionSetpoint(
     crazyflie_driver::Takeoff::Response& res)
   {
     ROS_INFO("Takeoff requested");
+    ServiceLock lock(*this);
+    if (!lock) {
+      return false;
+    }
     m_cf.takeoff(req.height, req.duration.toSec(), req.groupMask);
     return true;
   }
@@ -700,6 +1065,10 @@ void cmdPositionSetpoint(
     crazyflie_driver::Land::Response& res)
   {
     ROS_INFO("Land requested");
+    ServiceLock lock(*this);
+    if (!lock) {
+      return false;
+    }
     m_cf.land(req.height, req.duration.toSec(), req.groupMask);
     return true;
   }
@@ -709,6 +1078,10 @@ void cmdPositionSetpoint(
     crazyflie_driver::Stop::Response& res)
   {
     ROS_INFO("Stop requested");
+    ServiceLock lock(*this);
+    if (!lock) {
+      return false;
+    }
     m_cf.stop(req.groupMask);
     return true;
   }
@@ -718,6 +1091,10 @@ void cmdPositionSetpoint(
     crazyflie_driver::GoTo::Response& res)
   {
     ROS_INFO("GoTo requested");
+    ServiceLock lock(*this);
+    if (!lock) {
+      return false;
+    }
     m_cf.goTo(req.goal.x, req.goal.y, req.goal.z, req.yaw, req.duration.toSec(), req.relative, req.groupMask);
     return true;
   }
@@ -727,6 +1104,10 @@ void cmdPositionSetpoint(
     crazyflie_driver::UploadTrajectory::Response& res)
   {
     ROS_INFO("UploadTrajectory requested");
+    ServiceLock lock(*this);
+    if (!lock) {
+      return false;
+    }
 
     std::vector<Crazyflie::poly4d> pieces(req.pieces.size());
     for (size_t i = 0; i < pieces.size(); ++i) {
@@ -756,6 +1137,10 @@ void cmdPositionSetpoint(
     crazyflie_driver::StartTrajectory::Response& res)
   {
     ROS_INFO("StartTrajectory requested");
+    ServiceLock lock(*this);
+    if (!lock) {
+      return false;
+    }
     m_cf.startTrajectory(req.trajectoryId, req.timescale, req.reversed, req.relative, req.groupMask);
     return true;
   }
@@ -763,7 +1148,7 @@ void cmdPositionSetpoint(
 private:
   Crazyflie m_cf;
   std::string m_tf_prefix;
-  bool m_isEmergency;
+  std::atomic<bool> m_isEmergency;
   float m_roll_trim;
   float m_pitch_trim;
   bool m_enableLogging;
@@ -776,6 +1161,9 @@ private:
   bool m_enable_logging_pressure;
   bool m_enable_logging_battery;
   bool m_enable_logging_packets;
+  std::chrono::steady_clock::duration m_pingPeriod;
+  // download the TOCs even if they are cached
+  bool m_forceNoCache;
 
   ros::ServiceServer m_serviceEmergency;
   ros::ServiceServer m_serviceUpdateParams;
@@ -802,18 +1190,264 @@ private:
   ros::Publisher m_pubBattery;
   ros::Publisher m_pubPackets;
   ros::Publisher m_pubRssi;
+  ros::Publisher m_pubCommandLatency;
   std::vector<ros::Publisher> m_pubLogDataGeneric;
 
-  bool m_sentSetpoint, m_sentExternalPosition;
+  // live as long as the vehicle, not only during connect()
+  std::unique_ptr<LogBlock<logImu> > m_logBlockImu;
+  std::unique_ptr<LogBlock<log2> > m_logBlock2;
+  std::vector<std::unique_ptr<LogBlockGeneric> > m_logBlocksGeneric;
 
+  bool m_sentSetpoint, m_sentExternalPosition;
+  // since the last report, in s
+  double m_commandLatencySum;
+  double m_commandLatencyMax;
+  size_t m_commandLatencyCount;
+  std::chrono::steady_clock::time_point m_nextPing;
+  std::chrono::steady_clock::time_point m_nextReport;
+
+  RadioScheduler& m_scheduler;
+
+  // held while m_cf is used by a service call or by the scheduler
+  std::mutex m_linkMutex;
+  // connection bring-up; ends with it
   std::thread m_thread;
-  ros::CallbackQueue m_callback_queue;
+  // setpoints
+  SchedulerCallbackQueue m_callback_queue;
+  SchedulerCallbackQueue m_externalPositionQueue;
+  // shared by all vehicles, see CrazyflieServer::run()
+  ros::CallbackQueue& m_serviceQueue;
 };
 
+RadioScheduler::RadioScheduler(const std::string& radio)
+  : m_radio(radio)
+  , m_mutex()
+  , m_wakeUp()
+  , m_removed()
+  , m_vehicles()
+  , m_pending(false)
+  , m_running(true)
+  , m_round(0)
+  , m_broadcasts()
+  , m_commands()
+{
+  m_thread = std::thread(&RadioScheduler::run, this);
+}
+
+RadioScheduler::~RadioScheduler()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+  }
+  m_wakeUp.notify_one();
+  m_thread.join();
+}
+
+void RadioScheduler::add(CrazyflieROS* cf)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_vehicles.push_back(cf);
+    m_pending = true;
+  }
+  m_wakeUp.notify_one();
+}
+
+void RadioScheduler::remove(CrazyflieROS* cf)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_pending = true;
+  m_wakeUp.notify_one();
+  m_removed.wait(lock, [this, cf] {
+    return std::find(m_vehicles.begin(), m_vehicles.end(), cf) == m_vehicles.end();
+  });
+}
+
+void RadioScheduler::notify()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending = true;
+  }
+  m_wakeUp.notify_one();
+}
+
+void RadioScheduler::broadcastExternalPositions(
+  const std::string& broadcastUri,
+  std::vector<CrazyflieBroadcaster::externalPosition>& positions)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Broadcast& b = broadcast(broadcastUri);
+    b.positions.swap(positions);
+    positions.clear();
+    m_pending = true;
+  }
+  m_wakeUp.notify_one();
+}
+
+void RadioScheduler::broadcastExternalPoses(
+  const std::string& broadcastUri,
+  std::vector<CrazyflieBroadcaster::stateExternalBringup>& poses)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Broadcast& b = broadcast(broadcastUri);
+    b.poses.swap(poses);
+    poses.clear();
+    m_pending = true;
+  }
+  m_wakeUp.notify_one();
+}
+
+std::future<void> RadioScheduler::broadcastCommand(
+  const std::vector<std::string>& broadcastUris,
+  const BroadcastCommand& command,
+  int repeats)
+{
+  std::unique_ptr<PendingCommand> pending(new PendingCommand);
+  pending->command = command;
+  pending->repeats = std::max(repeats, 1);
+  std::future<void> result = pending->sent.get_future();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& uri : broadcastUris) {
+      pending->broadcasters.push_back(broadcast(uri).broadcaster.get());
+    }
+    m_commands.push_back(std::move(pending));
+    m_pending = true;
+  }
+  m_wakeUp.notify_one();
+  return result;
+}
+
+RadioScheduler::Broadcast& RadioScheduler::broadcast(const std::string& broadcastUri)
+{
+  auto it = m_broadcasts.find(broadcastUri);
+  if (it == m_broadcasts.end()) {
+    it = m_broadcasts.insert(std::make_pair(broadcastUri, Broadcast(broadcastUri))).first;
+  }
+  return it->second;
+}
+
+void RadioScheduler::run()
+{
+  std::vector<CrazyflieROS*> vehicles;
+  std::vector<CrazyflieROS*> ready;
+  std::vector<CrazyflieROS*> stopped;
+  std::vector<Broadcast*> broadcasts;
+  std::vector<std::unique_ptr<PendingCommand> > commands;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (m_running) {
+    // rotate the order, so no vehicle always comes first
+    vehicles.clear();
+    for (size_t i = 0; i < m_vehicles.size(); ++i) {
+      vehicles.push_back(m_vehicles[(m_round + i) % m_vehicles.size()]);
+    }
+    ++m_round;
+    m_pending = false;
+    broadcasts.clear();
+    for (auto& b : m_broadcasts) {
+      b.second.sendPositions.swap(b.second.positions);
+      b.second.positions.clear();
+      b.second.sendPoses.swap(b.second.poses);
+      b.second.poses.clear();
+      broadcasts.push_back(&b.second);
+    }
+    commands.clear();
+    commands.swap(m_commands);
+    lock.unlock();
+
+    // swarm-wide commands first
+    for (auto& pending : commands) {
+      try {
+        for (int i = 0; i < pending->repeats; ++i) {
+          for (auto broadcaster : pending->broadcasters) {
+            pending->command(*broadcaster);
+          }
+        }
+        pending->sent.set_value();
+      } catch (...) {
+        pending->sent.set_exception(std::current_exception());
+      }
+    }
+    bool busy = !commands.empty();
+
+    // vehicles in a service call are left to it until the next round
+    ready.clear();
+    for (auto cf : vehicles) {
+      if (cf->tryLockLink()) {
+        ready.push_back(cf);
+      }
+    }
+
+    stopped.clear();
+    for (auto cf : ready) {
+      if (cf->isEmergency()) {
+        cf->shutdown();
+        stopped.push_back(cf);
+      }
+    }
+    for (auto cf : ready) {
+      if (!cf->isEmergency()) {
+        busy |= cf->runCommand();
+      }
+    }
+    for (auto cf : ready) {
+      if (!cf->isEmergency()) {
+        busy |= cf->runExternalPosition();
+      }
+    }
+    // one packed packet carries the positions of several vehicles
+    for (auto b : broadcasts) {
+      if (!b->sendPositions.empty()) {
+        b->broadcaster->sendExternalPositions(b->sendPositions);
+        busy = true;
+      }
+      if (!b->sendPoses.empty()) {
+        b->broadcaster->sendPositionExternalBringup(b->sendPoses);
+        busy = true;
+      }
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto wakeUp = now + std::chrono::milliseconds(100);
+    for (auto cf : ready) {
+      if (!cf->isEmergency()) {
+        cf->serviceLink(now);
+        wakeUp = std::min(wakeUp, cf->nextDeadline());
+      }
+      cf->unlockLink();
+    }
+
+    lock.lock();
+    if (!stopped.empty()) {
+      for (auto cf : stopped) {
+        m_vehicles.erase(std::find(m_vehicles.begin(), m_vehicles.end(), cf));
+      }
+      m_removed.notify_all();
+    }
+    // more may be queued behind the callbacks of this round
+    if (!busy && !m_pending && m_running) {
+      m_wakeUp.wait_until(lock, wakeUp);
+    }
+  }
+}
+
 class CrazyflieServer
 {
 public:
   CrazyflieServer()
+    : m_schedulers()
+    , m_crazyflies()
+    , m_broadcastTargets()
+    , m_urisById()
+    , m_positionBatches()
+    , m_poseBatches()
+    , m_unknownIds(0)
+    , m_broadcastRepeats(3)
+    , m_pubDispatchTime()
+    , m_serviceQueue()
   {
 
   }
@@ -826,18 +1460,28 @@ public:
 
     ros::ServiceServer serviceAdd = n.advertiseService("add_crazyflie", &CrazyflieServer::add_crazyflie, this);
     ros::ServiceServer serviceRemove = n.advertiseService("remove_crazyflie", &CrazyflieServer::remove_crazyflie, this);
-
-    // // High-level API
-    // ros::ServiceServer serviceTakeoff = n.advertiseService("takeoff", &CrazyflieServer::takeoff, this);
-    // ros::ServiceServer serviceLand = n.advertiseService("land", &CrazyflieROS::land, this);
-    // ros::ServiceServer serviceStop = n.advertiseService("stop", &CrazyflieROS::stop, this);
-    // ros::ServiceServer serviceGoTo = n.advertiseService("go_to", &CrazyflieROS::goTo, this);
-    // ros::ServiceServer startTrajectory = n.advertiseService("start_trajectory", &CrazyflieROS::startTrajectory, this);
+    ros::Subscriber subscribeExternalPoses = n.subscribe("external_poses", 1, &CrazyflieServer::externalPosesChanged, this);
+
+    // High-level API, broadcast to all vehicles in a group
+    ros::NodeHandle("~").param("broadcast_repeats", m_broadcastRepeats, 3);
+    ros::ServiceServer serviceTakeoff = n.advertiseService("takeoff", &CrazyflieServer::takeoff, this);
+    ros::ServiceServer serviceLand = n.advertiseService("land", &CrazyflieServer::land, this);
+    ros::ServiceServer serviceStop = n.advertiseService("stop", &CrazyflieServer::stop, this);
+    ros::ServiceServer serviceGoTo = n.advertiseService("go_to", &CrazyflieServer::goTo, this);
+    ros::ServiceServer serviceStartTrajectory = n.advertiseService("start_trajectory", &CrazyflieServer::startTrajectory, this);
+    m_pubDispatchTime = n.advertise<std_msgs::Float32>("dispatch_time", 10);
+
+    // Services of all vehicles may take long (trajectory upload,
+    // parameters); a few threads answer them, so they hold up neither the
+    // radios nor this thread.
+    int serviceThreads;
+    ros::NodeHandle("~").param("service_threads", serviceThreads, 4);
+    ros::AsyncSpinner serviceSpinner(std::max(serviceThreads, 1), &m_serviceQueue);
+    serviceSpinner.start();
 
     while(ros::ok()) {
-      // Execute any ROS related functions now
-      callback_queue.callAvailable(ros::WallDuration(0.0));
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      // Execute any ROS related functions as soon as they arrive
+      callback_queue.callAvailable(ros::WallDuration(0.1));
     }
   }
 
@@ -862,6 +1506,14 @@ private:
       return false;
     }
 
+    std::string radio = radioOf(req.uri);
+    auto scheduler = m_schedulers.find(radio);
+    if (scheduler == m_schedulers.end()) {
+      ROS_INFO("Starting scheduler for %s", radio.c_str());
+      scheduler = m_schedulers.insert(std::make_pair(radio,
+        std::unique_ptr<RadioScheduler>(new RadioScheduler(radio)))).first;
+    }
+
     CrazyflieROS* cf = new CrazyflieROS(
       req.uri,
       req.tf_prefix,
@@ -876,10 +1528,31 @@ private:
       req.enable_logging_magnetic_field,
       req.enable_logging_pressure,
       req.enable_logging_battery,
-      req.enable_logging_packets);
+      req.enable_logging_packets,
+      req.ping_rate,
+      req.force_no_cache,
+      *scheduler->second,
+      m_serviceQueue);
 
     m_crazyflies[req.uri] = cf;
 
+    int id = broadcastIdOf(req.uri);
+    if (id >= 0) {
+      BroadcastTarget target = {broadcastUriOf(req.uri), id};
+      std::vector<std::string>& uris = m_urisById[id];
+      for (const auto& uri : uris) {
+        if (m_broadcastTargets[uri].broadcastUri == target.broadcastUri) {
+          ROS_WARN("%s and %s share id %d on the same channel; their external poses cannot be told apart.",
+            req.uri.c_str(), uri.c_str(), id);
+        }
+      }
+      if (!uris.empty()) {
+        ROS_INFO("%s shares id %d with another Crazyflie; external poses need their uris.", req.uri.c_str(), id);
+      }
+      uris.push_back(req.uri);
+      m_broadcastTargets[req.uri] = target;
+    }
+
     return true;
   }
 
@@ -895,6 +1568,13 @@ private:
 
     ROS_INFO("Removing crazyflie at uri %s.", req.uri.c_str());
 
+    auto target = m_broadcastTargets.find(req.uri);
+    if (target != m_broadcastTargets.end()) {
+      std::vector<std::string>& uris = m_urisById[target->second.id];
+      uris.erase(std::remove(uris.begin(), uris.end(), req.uri), uris.end());
+      m_broadcastTargets.erase(target);
+    }
+
     m_crazyflies[req.uri]->stop();
     delete m_crazyflies[req.uri];
     m_crazyflies.erase(req.uri);
@@ -904,55 +1584,249 @@ private:
     return true;
   }
 
-  // bool takeoff(
-  //   crazyflie_driver::Takeoff::Request& req,
-  //   crazyflie_driver::Takeoff::Response& res)
-  // {
-  //   ROS_INFO("Takeoff requested");
-  //   m_cfbc.takeoff(req.height, req.duration.toSec(), req.groupMask);
-  //   return true;
-  // }
-
-  // bool land(
-  //   crazyflie_driver::Land::Request& req,
-  //   crazyflie_driver::Land::Response& res)
-  // {
-  //   ROS_INFO("Land requested");
-  //   m_cfbc.land(req.height, req.duration.toSec(), req.groupMask);
-  //   return true;
-  // }
-
-  // bool stop(
-  //   crazyflie_driver::Stop::Request& req,
-  //   crazyflie_driver::Stop::Response& res)
-  // {
-  //   ROS_INFO("Stop requested");
-  //   m_cfbc.stop(req.groupMask);
-  //   return true;
-  // }
-
-  // bool goTo(
-  //   crazyflie_driver::GoTo::Request& req,
-  //   crazyflie_driver::GoTo::Response& res)
-  // {
-  //   ROS_INFO("GoTo requested");
-  //   // this is always relative
-  //   m_cfbc.goTo(req.goal.x, req.goal.y, req.goal.z, req.yaw, req.duration.toSec(), req.groupMask);
-  //   return true;
-  // }
-
-  // bool startTrajectory(
-  //   crazyflie_driver::StartTrajectory::Request& req,
-  //   crazyflie_driver::StartTrajectory::Response& res)
-  // {
-  //   ROS_INFO("StartTrajectory requested");
-  //   // this is always relative
-  //   m_cfbc.startTrajectory(req.index, req.numPieces, req.timescale, req.reversed, req.groupMask);
-  //   return true;
-  // }
+  /**
+   * Poses of the whole swarm from one mocap frame. They are sorted by
+   * broadcast address and sent in packed broadcast packets, several
+   * vehicles per packet: with orientations, two per packet with compressed
+   * quaternions, otherwise four positions per packet. ids are the last
+   * bytes of the radio addresses; uris are needed only if two vehicles
+   * share one. uris and orientations may be empty.
+   */
+  void externalPosesChanged(
+    const crazyflie_driver::ExternalPoses::ConstPtr& msg)
+  {
+    bool withOrientation = !msg->orientations.empty();
+    bool withUris = !msg->uris.empty();
+    if (msg->positions.size() != msg->ids.size()
+        || (withOrientation && msg->orientations.size() != msg->ids.size())
+        || (withUris && msg->uris.size() != msg->ids.size())) {
+      ROS_WARN_THROTTLE(1, "Ignoring external poses: %zu ids, %zu uris, %zu positions, %zu orientations",
+        msg->ids.size(), msg->uris.size(), msg->positions.size(), msg->orientations.size());
+      return;
+    }
+
+    for (auto& batch : m_positionBatches) {
+      batch.second.clear();
+    }
+    for (auto& batch : m_poseBatches) {
+      batch.second.clear();
+    }
+    for (size_t i = 0; i < msg->ids.size(); ++i) {
+      const BroadcastTarget* target = nullptr;
+      if (withUris) {
+        auto it = m_broadcastTargets.find(msg->uris[i]);
+        if (it != m_broadcastTargets.end()) {
+          target = &it->second;
+        }
+      } else {
+        auto it = m_urisById.find(msg->ids[i]);
+        if (it != m_urisById.end() && it->second.size() == 1) {
+          target = &m_broadcastTargets[it->second.front()];
+        } else if (it != m_urisById.end() && it->second.size() > 1) {
+          ROS_WARN_THROTTLE(1, "Id %d is used by %zu Crazyflies; external poses need their uris.",
+            msg->ids[i], it->second.size());
+        }
+      }
+      if (!target) {
+        // e.g. objects tracked but not flown
+        ++m_unknownIds;
+        continue;
+      }
+      const geometry_msgs::Point& p = msg->positions[i];
+      if (withOrientation) {
+        const geometry_msgs::Quaternion& q = msg->orientations[i];
+        CrazyflieBroadcaster::stateExternalBringup pose;
+        pose.id = target->id;
+        pose.x = p.x;
+        pose.y = p.y;
+        pose.z = p.z;
+        pose.q0 = q.x;
+        pose.q1 = q.y;
+        pose.q2 = q.z;
+        pose.q3 = q.w;
+        m_poseBatches[target->broadcastUri].push_back(pose);
+      } else {
+        CrazyflieBroadcaster::externalPosition position;
+        position.id = target->id;
+        position.x = p.x;
+        position.y = p.y;
+        position.z = p.z;
+        m_positionBatches[target->broadcastUri].push_back(position);
+      }
+    }
+
+    for (auto& batch : m_positionBatches) {
+      if (!batch.second.empty()) {
+        scheduler(batch.first).broadcastExternalPositions(batch.first, batch.second);
+      }
+    }
+    for (auto& batch : m_poseBatches) {
+      if (!batch.second.empty()) {
+        scheduler(batch.first).broadcastExternalPoses(batch.first, batch.second);
+      }
+    }
+    if (m_unknownIds > 0) {
+      ROS_DEBUG_THROTTLE(1, "%zu external poses for unknown vehicles so far", m_unknownIds);
+    }
+  }
+
+  RadioScheduler& scheduler(const std::string& broadcastUri)
+  {
+    return *m_schedulers[radioOf(broadcastUri)];
+  }
+
+  bool takeoff(
+    crazyflie_driver::Takeoff::Request& req,
+    crazyflie_driver::Takeoff::Response& res)
+  {
+    ROS_INFO("Takeoff requested");
+    float height = req.height;
+    float duration = req.duration.toSec();
+    uint8_t groupMask = req.groupMask;
+    return broadcast("takeoff", [=](CrazyflieBroadcaster& cfbc) {
+      cfbc.takeoff(height, duration, groupMask);
+    });
+  }
+
+  bool land(
+    crazyflie_driver::Land::Request& req,
+    crazyflie_driver::Land::Response& res)
+  {
+    ROS_INFO("Land requested");
+    float height = req.height;
+    float duration = req.duration.toSec();
+    uint8_t groupMask = req.groupMask;
+    return broadcast("land", [=](CrazyflieBroadcaster& cfbc) {
+      cfbc.land(height, duration, groupMask);
+    });
+  }
+
+  bool stop(
+    crazyflie_driver::Stop::Request& req,
+    crazyflie_driver::Stop::Response& res)
+  {
+    ROS_INFO("Stop requested");
+    uint8_t groupMask = req.groupMask;
+    return broadcast("stop", [=](CrazyflieBroadcaster& cfbc) {
+      cfbc.stop(groupMask);
+    });
+  }
+
+  bool goTo(
+    crazyflie_driver::GoTo::Request& req,
+    crazyflie_driver::GoTo::Response& res)
+  {
+    ROS_INFO("GoTo requested");
+    // this is always relative; an absolute goal differs per vehicle
+    if (!req.relative) {
+      ROS_ERROR("Only relative goTo can be broadcast, use <tf_prefix>/go_to instead.");
+      return false;
+    }
+    float x = req.goal.x;
+    float y = req.goal.y;
+    float z = req.goal.z;
+    float yaw = req.yaw;
+    float duration = req.duration.toSec();
+    uint8_t groupMask = req.groupMask;
+    return broadcast("goTo", [=](CrazyflieBroadcaster& cfbc) {
+      cfbc.goTo(x, y, z, yaw, duration, groupMask);
+    });
+  }
+
+  bool startTrajectory(
+    crazyflie_driver::StartTrajectory::Request& req,
+    crazyflie_driver::StartTrajectory::Response& res)
+  {
+    ROS_INFO("StartTrajectory requested");
+    // this is always relative
+    if (!req.relative) {
+      ROS_ERROR("Only relative trajectories can be broadcast, use <tf_prefix>/start_trajectory instead.");
+      return false;
+    }
+    uint8_t trajectoryId = req.trajectoryId;
+    float timescale = req.timescale;
+    bool reversed = req.reversed;
+    uint8_t groupMask = req.groupMask;
+    return broadcast("startTrajectory", [=](CrazyflieBroadcaster& cfbc) {
+      cfbc.startTrajectory(trajectoryId, timescale, reversed, groupMask);
+    });
+  }
+
+  // Sends a command on every channel in use, all radios at once, and
+  // reports how long it took until the last copy was sent.
+  bool broadcast(
+    const char* name,
+    const RadioScheduler::BroadcastCommand& command)
+  {
+    auto start = std::chrono::steady_clock::now();
+
+    std::map<std::string, std::vector<std::string> > broadcastUris;
+    for (const auto& cf : m_crazyflies) {
+      std::string uri = broadcastUriOf(cf.first);
+      if (uri.empty()) {
+        continue;
+      }
+      std::vector<std::string>& uris = broadcastUris[radioOf(uri)];
+      if (std::find(uris.begin(), uris.end(), uri) == uris.end()) {
+        uris.push_back(uri);
+      }
+    }
+    if (broadcastUris.empty()) {
+      ROS_WARN("No Crazyflie to send %s to.", name);
+      return false;
+    }
+
+    std::vector<std::future<void> > sent;
+    for (const auto& radio : broadcastUris) {
+      sent.push_back(m_schedulers[radio.first]->broadcastCommand(
+        radio.second, command, m_broadcastRepeats));
+    }
+    for (auto& s : sent) {
+      // once queued, the command goes out; failing here would make a retry
+      // send it twice, e.g. doubling a relative goTo
+      while (s.wait_for(std::chrono::seconds(1)) != std::future_status::ready) {
+        ROS_WARN("Still sending %s ...", name);
+      }
+      try {
+        s.get();
+      } catch (std::exception& e) {
+        ROS_ERROR("Could not send %s: %s", name, e.what());
+        return false;
+      }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    ROS_INFO("Sent %s on %zu radio(s) in %f ms", name, sent.size(), elapsed.count() * 1e3);
+    std_msgs::Float32 msg;
+    msg.data = elapsed.count();
+    m_pubDispatchTime.publish(msg);
+    return true;
+  }
 
 private:
+  // one per Crazyradio; declared first, so it outlives the vehicles on it
+  std::map<std::string, std::unique_ptr<RadioScheduler> > m_schedulers;
   std::map<std::string, CrazyflieROS*> m_crazyflies;
+
+  struct BroadcastTarget
+  {
+    std::string broadcastUri;
+    // see broadcastIdOf()
+    int id;
+  };
+  // by uri
+  std::map<std::string, BroadcastTarget> m_broadcastTargets;
+  // for external poses without uris
+  std::map<int, std::vector<std::string> > m_urisById;
+  // by broadcast uri; reused for every frame
+  std::map<std::string, std::vector<CrazyflieBroadcaster::externalPosition> > m_positionBatches;
+  std::map<std::string, std::vector<CrazyflieBroadcaster::stateExternalBringup> > m_poseBatches;
+  size_t m_unknownIds;
+
+  // copies of each high-level broadcast
+  int m_broadcastRepeats;
+  ros::Publisher m_pubDispatchTime;
+  ros::CallbackQueue m_serviceQueue;
 };
 
 
@@ -22,6 +22,7 @@
 #include <iostream>
 #include <iomanip>
 #include <ios>
+#include <string>
 #include <vector>
 #include <cmath>
 #include <stdio.h>
@@ -407,6 +408,86 @@ std::ostream& operator<<( std::ostream& s, Quaternion4f const& q )
    return s;
 }
 
+/*!
+ * \brief Reads packed frame data, optionally without going past its end.
+ * 
+ * Counts are checked against the bytes that are left, so a truncated or
+ * corrupt packet fails before anything is read beyond it.
+ */
+class PackedReader
+{
+public:
+   //! \brief Unbounded reader; the caller vouches for the data.
+   explicit PackedReader( char const* data ) :
+      _data(data),
+      _end(0),
+      _bounded(false)
+   {
+   }
+   
+   //! \brief Reader that stops at \c end.
+   PackedReader( char const* data, char const* end ) :
+      _data(data),
+      _end(end),
+      _bounded(true)
+   {
+   }
+   
+   //! \brief Pointer to the next unread byte.
+   char const* position() const { return _data; }
+   
+   //! \brief Copy the next \c size bytes to \c out.
+   bool read( void* out, size_t size )
+   {
+      if( _bounded && static_cast<size_t>(_end - _data) < size )
+         return false;
+      if( size > 0 )
+         memcpy(out, _data, size);
+      _data += size;
+      return true;
+   }
+   
+   template<typename T>
+   bool read( T& value ) { return read(&value, sizeof(T)); }
+   
+   /*!
+    * \brief Read the count of a list.
+    * 
+    * \param recordSize smallest size of one element of the list
+    * \returns false if the count is negative or the list cannot fit
+    */
+   bool readCount( int& count, size_t recordSize )
+   {
+      if( !read(count) || count < 0 )
+         return false;
+      return !_bounded || static_cast<size_t>(count) <= static_cast<size_t>(_end - _data) / recordSize;
+   }
+   
+   //! \brief Read a NUL-terminated string.
+   bool readString( std::string& value )
+   {
+      size_t length;
+      if( _bounded )
+      {
+         if( _data == _end )
+            return false;
+         char const* nul = static_cast<char const*>(memchr(_data, '\0', _end - _data));
+         if( !nul )
+            return false;
+         length = nul - _data;
+      }
+      else
+         length = strlen(_data);
+      value.assign(_data, length); _data += length + 1;
+      return true;
+   }
+   
+private:
+   char const* _data;
+   char const* _end;
+   bool _bounded;
+};
+
 /*!
  * \brief Rigid body
  * \author Philip G. Lee
@@ -482,30 +563,39 @@ public:
     * \returns pointer to data immediately following the RigidBody data
     */
    char const* unpack(char const* data, char nnMajor, char nnMinor)
+   {
+      PackedReader reader(data);
+      unpack(reader, nnMajor, nnMinor);
+      return reader.position();
+   }
+   
+   /*!
+    * \brief Unpack rigid body data without reading past the reader's end.
+    * 
+    * \returns false if the data is truncated or corrupt
+    */
+   bool unpack(PackedReader& reader, char nnMajor, char nnMinor)
    {
       int i;
       float x,y,z;
       
       // Rigid body ID
-      memcpy(&_id,data,4); data += 4;
+      if( !reader.read(_id) )
+         return false;
       
       // Location and orientation.
-      memcpy(&_loc.x,data,4); data += 4;
-      memcpy(&_loc.y,data,4); data += 4;
-      memcpy(&_loc.z,data,4); data += 4;
-      memcpy(&_ori.qx,data,4); data += 4;
-      memcpy(&_ori.qy,data,4); data += 4;
-      memcpy(&_ori.qz,data,4); data += 4;
-      memcpy(&_ori.qw,data,4); data += 4;
+      if( !reader.read(_loc.x) || !reader.read(_loc.y) || !reader.read(_loc.z)
+         || !reader.read(_ori.qx) || !reader.read(_ori.qy) || !reader.read(_ori.qz) || !reader.read(_ori.qw) )
+         return false;
       
-      // Associated markers
+      // Associated markers; with NatNet >= 2, each also has an ID and a size
       int nMarkers = 0;
-      memcpy(&nMarkers,data,4); data += 4;
+      if( !reader.readCount(nMarkers, nnMajor >= 2 ? 20 : 12) )
+         return false;
       for( i = 0; i < nMarkers; ++i )
       {
-         memcpy(&x,data,4); data += 4;
-         memcpy(&y,data,4); data += 4;
-         memcpy(&z,data,4); data += 4;
+         if( !reader.read(x) || !reader.read(y) || !reader.read(z) )
+            return false;
          _markers.push_back(Point3f(x,y,z));
       }
 
@@ -515,7 +605,8 @@ public:
          uint32_t id = 0;
          for( i = 0; i < nMarkers; ++i )
          {
-            memcpy(&id,data,4); data += 4;
+            if( !reader.read(id) )
+               return false;
             _mId.push_back(id);
          }
 
@@ -523,21 +614,24 @@ public:
          float size;
          for( i = 0; i < nMarkers; ++i )
          {
-            memcpy(&size,data,4); data += 4;
+            if( !reader.read(size) )
+               return false;
             _mSize.push_back(size);
          }
 
          if( ((nnMajor==2) && (nnMinor >= 6)) || (nnMajor > 2) || (nnMajor == 0) )
          {
             uint16_t tmp;
-            memcpy(&tmp, data, 2); data += 2;
+            if( !reader.read(tmp) )
+               return false;
             _trackingValid = tmp & 0x01;
          }
          // Mean marker error
-         memcpy(&_mErr,data,4); data += 4;
+         if( !reader.read(_mErr) )
+            return false;
       }
       
-      return data;
+      return true;
    }
    
 private:
@@ -614,25 +708,32 @@ public:
     */
    char const* unpack(char const* data)
    {
-      char n[256]; n[255] = '\0';
+      PackedReader reader(data);
+      unpack(reader);
+      return reader.position();
+   }
+   
+   /*!
+    * \brief Unpack the set without reading past the reader's end.
+    * 
+    * \returns false if the data is truncated or corrupt
+    */
+   bool unpack(PackedReader& reader)
+   {
       int numMarkers;
       int i;
       float x,y,z;
       
-      strncpy(n,data,sizeof(n)-1);
-      _name = n;
-      data += strlen(n)+1;
-      
-      memcpy(&numMarkers, data, 4); data += 4;
+      if( !reader.readString(_name) || !reader.readCount(numMarkers, 12) )
+         return false;
       for( i = 0; i < numMarkers; ++i )
       {
-         memcpy(&x,data,4); data += 4;
-         memcpy(&y,data,4); data += 4;
-         memcpy(&z,data,4); data += 4;
+         if( !reader.read(x) || !reader.read(y) || !reader.read(z) )
+            return false;
          _markers.push_back(Point3f(x,y,z));
       }
       
-      return data;
+      return true;
    }
    
 private:
@@ -696,20 +797,33 @@ public:
     * \returns pointer to data immediately following the Skeleton data
     */
    char const* unpack( char const* data, char nnMajor, char nnMinor )
+   {
+      PackedReader reader(data);
+      unpack(reader, nnMajor, nnMinor);
+      return reader.position();
+   }
+   
+   /*!
+    * \brief Unpack skeleton data without reading past the reader's end.
+    * 
+    * \returns false if the data is truncated or corrupt
+    */
+   bool unpack( PackedReader& reader, char nnMajor, char nnMinor )
    {
       int i;
       int numRigid = 0;
       
-      memcpy(&_id,data,4); data += 4;
-      memcpy(&numRigid,data,4); data += 4;
+      if( !reader.read(_id) || !reader.readCount(numRigid, 36) )
+         return false;
       for( i = 0; i < numRigid; ++i )
       {
          RigidBody b;
-         data = b.unpack( data, nnMajor, nnMinor );
+         if( !b.unpack( reader, nnMajor, nnMinor ) )
+            return false;
          _rBodies.push_back(b);
       }
       
-      return data;
+      return true;
    }
    
 private:
@@ -767,13 +881,20 @@ public:
     */
    char const* unpack( char const* data )
    {
-      memcpy(&_id,data,4); data += 4;
-      memcpy(&_p.x,data,4); data += 4;
-      memcpy(&_p.y,data,4); data += 4;
-      memcpy(&_p.z,data,4); data += 4;
-      memcpy(&_size,data,4); data += 4;
-      
-      return data;
+      PackedReader reader(data);
+      unpack(reader);
+      return reader.position();
+   }
+   
+   /*!
+    * \brief Unpack the marker without reading past the reader's end.
+    * 
+    * \returns false if the data is truncated
+    */
+   bool unpack( PackedReader& reader )
+   {
+      return reader.read(_id) && reader.read(_p.x) && reader.read(_p.y)
+         && reader.read(_p.z) && reader.read(_size);
    }
    
 private:
@@ -917,44 +1038,75 @@ public:
     * \returns pointer to data immediately following the frame data
     */
    char const* unpack(char const* data)
+   {
+      PackedReader reader(data);
+      unpack(reader);
+      return reader.position();
+   }
+   
+   /*!
+    * \brief Unpack frame data without reading past \c end.
+    * 
+    * Use this for data straight from the network: a truncated or corrupt
+    * packet is detected before anything beyond \c end is read.
+    * 
+    * \param data input data buffer
+    * \param end end of the input data
+    * \returns pointer to data immediately following the frame data, or
+    *    \c 0 if the data is truncated or corrupt
+    */
+   char const* unpack(char const* data, char const* end)
+   {
+      PackedReader reader(data, end);
+      if( !unpack(reader) )
+         return 0;
+      return reader.position();
+   }
+   
+private:
+   
+   bool unpack(PackedReader& reader)
    {
       int i;
       int numUidMarkers;
       float x,y,z;
       
-      //char const* const dataBeg = data;
-      
       // NOTE: need to worry about network order here?
       
       // Get frame number.
-      memcpy(&_frameNum, data, 4); data += 4;
+      if( !reader.read(_frameNum) )
+         return false;
       
       // Get marker sets.
-      memcpy(&_numMarkerSets, data, 4); data += 4;
+      if( !reader.readCount(_numMarkerSets, 5) )
+         return false;
       for( i = 0; i < _numMarkerSets; ++i )
       {
          MarkerSet set;
-         data = set.unpack(data);
+         if( !set.unpack(reader) )
+            return false;
          _markerSet.push_back(set);
       }
       
       // Get unidentified markers.
-      memcpy(&numUidMarkers,data,4); data += 4;
+      if( !reader.readCount(numUidMarkers, 12) )
+         return false;
       for( i = 0; i < numUidMarkers; ++i )
       {
-         memcpy(&x,data,4); data += 4;
-         memcpy(&y,data,4); data += 4;
-         memcpy(&z,data,4); data += 4;
+         if( !reader.read(x) || !reader.read(y) || !reader.read(z) )
+            return false;
          _uidMarker.push_back(Point3f(x,y,z));
       }
       
       // Get rigid bodies
       _numRigidBodies = 0;
-      memcpy(&_numRigidBodies,data,4); data += 4;
+      if( !reader.readCount(_numRigidBodies, 36) )
+         return false;
       for( i = 0; i < _numRigidBodies; ++i )
       {
          RigidBody b;
-         data = b.unpack(data, _nnMajor, _nnMinor);
+         if( !b.unpack(reader, _nnMajor, _nnMinor) )
+            return false;
          _rBodies.push_back(b);
       }
       
@@ -962,11 +1114,13 @@ public:
       if( _nnMajor > 2 || (_nnMajor==2 && _nnMinor >= 1) )
       {
          int numSkel = 0;
-         memcpy(&numSkel,data,4); data += 4;
+         if( !reader.readCount(numSkel, 8) )
+            return false;
          for( i = 0; i < numSkel; ++i )
          {
             Skeleton s;
-            data = s.unpack( data, _nnMajor, _nnMinor );
+            if( !s.unpack( reader, _nnMajor, _nnMinor ) )
+               return false;
             _skel.push_back(s);
          }
       }
@@ -975,35 +1129,27 @@ public:
       if( _nnMajor > 2 || (_nnMajor==2 && _nnMinor >= 3) )
       {
          int numLabMark = 0;
-         memcpy(&numLabMark,data,4); data += 4;
+         if( !reader.readCount(numLabMark, 20) )
+            return false;
          for( i = 0; i < numLabMark; ++i )
          {
             LabeledMarker lm;
-            data = lm.unpack(data);
+            if( !lm.unpack(reader) )
+               return false;
             _labeledMarkers.push_back(lm);
          }
       }
       
       // TODO: add version check
       int numForcePlates = 0;
-      memcpy(&numForcePlates,data,4); data += 4;
-
-      // Get latency/timecode
-      memcpy(&_latency,data,4); data += 4;
       
-      // Get timecode
-      memcpy(&_timecode,data,4); data += 4;
-      memcpy(&_subTimecode,data,4); data += 4;
-      
-      // Get "end of data" tag
+      // Get latency/timecode, timecode and "end of data" tag
       int eod = 0;
-      memcpy(&eod,data,4); data += 4;
-      
-      return data;
+      return reader.read(numForcePlates) && reader.read(_latency)
+         && reader.read(_timecode) && reader.read(_subTimecode)
+         && reader.read(eod);
    }
    
-private:
-   
    unsigned char _nnMajor;
    unsigned char _nnMinor;
    
@@ -123,6 +123,16 @@ public:
     std::string getVersionString(){
         return stringVersion;
     }
+
+    // for clients that receive frames themselves instead of update()
+    int getDataSocket(){
+        return sdData;
+    }
+
+    void getNatNetVersion(unsigned char& major, unsigned char& minor){
+        major = natNetMajor;
+        minor = natNetMinor;
+    }
     
 #ifdef USE_FPS
     double getFps(){return fps.getFps();}
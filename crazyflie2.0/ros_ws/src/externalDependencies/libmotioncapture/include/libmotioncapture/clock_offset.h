@@ -0,0 +1,91 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+namespace libmotioncapture {
+
+  // Maps time stamps of a mocap system's clock onto the host's steady clock.
+  //
+  // Every frame gives one sample of host time minus device time, which is
+  // the true offset plus a positive transport delay. The fastest sample of
+  // the last two windows is taken as the offset; the windows keep up with
+  // drift between the clocks. The remaining constant transport delay cannot
+  // be observed from one-way samples and stays in the mapped times.
+  class ClockOffsetEstimator
+  {
+  public:
+    explicit ClockOffsetEstimator(
+      size_t windowSize = 1000)
+      : m_windowSize(std::max<size_t>(windowSize, 1))
+    {
+      reset();
+    }
+
+    void reset()
+    {
+      m_count = 0;
+      m_lastDeviceTime = 0;
+      m_windowMin = 0;
+      m_previousWindowMin = 0;
+      m_delay = 0;
+    }
+
+    // deviceTime: seconds on the device clock; a step back restarts the
+    // estimate (e.g. a restarted server or replay)
+    void update(
+      double deviceTime,
+      std::chrono::steady_clock::time_point hostTime)
+    {
+      if (m_count > 0 && deviceTime < m_lastDeviceTime) {
+        reset();
+      }
+      m_lastDeviceTime = deviceTime;
+      double offset = seconds(hostTime) - deviceTime;
+      if (m_count % m_windowSize == 0) {
+        m_previousWindowMin = m_count > 0 ? m_windowMin : offset;
+        m_windowMin = offset;
+      }
+      ++m_count;
+      m_windowMin = std::min(m_windowMin, offset);
+      m_delay = offset - this->offset();
+    }
+
+    bool valid() const {
+      return m_count > 0;
+    }
+
+    // host minus device time, in seconds
+    double offset() const {
+      return std::min(m_windowMin, m_previousWindowMin);
+    }
+
+    // transport delay of the last sample beyond the fastest one, in seconds
+    double delay() const {
+      return m_delay;
+    }
+
+    std::chrono::steady_clock::time_point toHost(
+      double deviceTime) const
+    {
+      return std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(deviceTime + offset())));
+    }
+
+  private:
+    static double seconds(std::chrono::steady_clock::time_point time)
+    {
+      return std::chrono::duration<double>(time.time_since_epoch()).count();
+    }
+
+  private:
+    size_t m_windowSize;
+    size_t m_count;
+    double m_lastDeviceTime;
+    double m_windowMin;
+    double m_previousWindowMin;
+    double m_delay;
+  };
+
+} // namespace libobjecttracker
@@ -0,0 +1,87 @@
+#pragma once
+#include "libmotioncapture/motioncapture.h"
+
+#include <Eigen/Geometry>
+
+namespace libmotioncapture {
+
+  // one backend of MotionCaptureFusion
+  struct FusionSource
+  {
+    FusionSource(
+      MotionCapture* mocap,
+      const std::string& name,
+      const Eigen::Affine3f& toWorld = Eigen::Affine3f::Identity(),
+      float weight = 1.0f)
+      : mocap(mocap)
+      , name(name)
+      , rotation(toWorld.linear())
+      , translation(toWorld.translation())
+      , weight(weight)
+    {
+    }
+
+    // owned by the fusion backend from then on
+    MotionCapture* mocap;
+    // prefix of its latency entries
+    std::string name;
+    // rigid transformation from the source's frame to the common world
+    // frame (not an Affine3f, which would need an aligned allocator)
+    Eigen::Matrix3f rotation;
+    Eigen::Vector3f translation;
+    // relative trust in its poses
+    float weight;
+  };
+
+  class MotionCaptureFusionImpl;
+
+  // Runs several backends at once, e.g. overlapping Vicon and OptiTrack
+  // volumes, each on its own receive thread, and merges them into one
+  // stream. A new frame starts whenever any source delivers one. Every
+  // source's poses are interpolated or predicted to that frame's capture
+  // time and averaged by weight; point clouds of sources no older than
+  // maxAge are concatenated. Errors and timeouts of single sources are
+  // counted and reported by getLatency(), not thrown, so the stream goes on
+  // without them.
+  class MotionCaptureFusion
+    : public MotionCapture
+  {
+  public:
+    // maxAge: how far a source's poses may be predicted, and how old its
+    // point cloud may be, to be part of a frame
+    MotionCaptureFusion(
+      const std::vector<FusionSource>& sources,
+      std::chrono::milliseconds maxAge = std::chrono::milliseconds(20));
+
+    virtual ~MotionCaptureFusion();
+
+    size_t sourceCount() const;
+
+    // Contribution of each source to the objects of getObjects(), in the
+    // same order: result[i * sourceCount() + j] is the normalized weight of
+    // source j in object i, 0 if the source did not see it.
+    void getObjectWeights(std::vector<float>& result) const;
+
+    // implementations for MotionCapture interface
+    virtual void waitForNextFrame();
+    virtual void getObjects(std::vector<Object>& result) const;
+    virtual void getPointCloud(
+      pcl::PointCloud<pcl::PointXYZ>::Ptr result) const;
+    virtual void getLatency(
+      std::vector<LatencyInfo>& result) const;
+
+    virtual bool supportsObjectTracking() const;
+    virtual bool supportsLatencyEstimate() const;
+    virtual bool supportsPointCloud() const;
+    virtual bool supportsReceiveStatistics() const;
+
+    // sum over the sources that support it
+    virtual void getReceiveStatistics(
+      ReceiveStatistics& result) const;
+
+  private:
+    MotionCaptureFusionImpl* pImpl;
+  };
+
+} // namespace libobjecttracker
+
@@ -1,9 +1,14 @@
 #pragma once
 #include <cstddef>
 #include <stdint.h>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "libmotioncapture/clock_offset.h"
+
 // PCL
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -21,6 +26,7 @@ namespace libmotioncapture {
       , m_position(position)
       , m_rotation(rotation)
       , m_occluded(false)
+      , m_captureTime()
     {
     }
 
@@ -30,6 +36,7 @@ namespace libmotioncapture {
       , m_position()
       , m_rotation()
       , m_occluded(true)
+      , m_captureTime()
     {
     }
 
@@ -38,6 +45,7 @@ namespace libmotioncapture {
       , m_position()
       , m_rotation()
       , m_occluded(true)
+      , m_captureTime()
     {
     }
 
@@ -57,11 +65,21 @@ namespace libmotioncapture {
       return m_occluded;
     }
 
+    // when the cameras took the frame, see MotionCapture::captureTime()
+    std::chrono::steady_clock::time_point captureTime() const {
+      return m_captureTime;
+    }
+
+    void setCaptureTime(std::chrono::steady_clock::time_point time) {
+      m_captureTime = time;
+    }
+
   private:
     std::string m_name;
     Eigen::Vector3f m_position;
     Eigen::Quaternionf m_rotation;
     bool m_occluded;
+    std::chrono::steady_clock::time_point m_captureTime;
   };
 
   class LatencyInfo
@@ -87,18 +105,110 @@ namespace libmotioncapture {
     double m_value;
   };
 
-  class MotionCapture
+  // everything received with one frame
+  struct Frame
+  {
+    Frame()
+      : sequence(0)
+      , receiveTime()
+      , captureTime()
+      , objects()
+      , pointCloud(new pcl::PointCloud<pcl::PointXYZ>)
+      , latency()
+    {
+    }
+
+    // counts up from 1 with every received frame
+    uint64_t sequence;
+    // when waitForNextFrame() returned
+    std::chrono::steady_clock::time_point receiveTime;
+    std::chrono::steady_clock::time_point captureTime;
+    std::vector<Object> objects;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr pointCloud;
+    std::vector<LatencyInfo> latency;
+  };
+
+  // totals since the connection was established
+  struct ReceiveStatistics
+  {
+    ReceiveStatistics()
+      : frames(0)
+      , dropped(0)
+      , late(0)
+      , malformed(0)
+      , overflows(0)
+    {
+    }
+
+    uint64_t frames;
+    // missing frame numbers in the stream
+    uint64_t dropped;
+    // frames older than one received before, discarded
+    uint64_t late;
+    uint64_t malformed;
+    // received frames discarded because the consumer fell behind
+    uint64_t overflows;
+  };
+
+  // thrown by waitForNextFrame() if no frame arrived in time
+  class FrameTimeout : public std::runtime_error
   {
   public:
-    virtual ~MotionCapture()
+    explicit FrameTimeout(const std::string& what)
+      : std::runtime_error(what)
     {
     }
+  };
 
-    // waits until a new frame is available
+  // thrown by waitForNextFrame() of finite streams after the last frame
+  class EndOfStream : public std::runtime_error
+  {
+  public:
+    explicit EndOfStream(const std::string& what)
+      : std::runtime_error(what)
+    {
+    }
+  };
+
+  // stable index of an object name, see MotionCapture::objectHandle()
+  typedef uint32_t ObjectHandle;
+
+  class MotionCaptureReceiver;
+  class MotionCaptureObjectTable;
+
+  class MotionCapture
+  {
+  public:
+    MotionCapture();
+
+    // implementations must call stopReceiveThread() in their destructor
+    virtual ~MotionCapture();
+
+    MotionCapture(const MotionCapture&) = delete;
+    MotionCapture& operator=(const MotionCapture&) = delete;
+
+    // waits until a new frame is available; backends that support a frame
+    // timeout throw FrameTimeout if none arrives in time
     virtual void waitForNextFrame() = 0;
 
+    // 0 (the default) waits forever; supported by all backends
+    void setFrameTimeout(std::chrono::milliseconds timeout);
+    std::chrono::milliseconds frameTimeout() const;
+
     // Query data
 
+    // When the current frame was captured, on the host's steady clock. Derived
+    // from the device's time stamps where the backend has them, otherwise
+    // from the arrival time minus the reported processing latency. Objects
+    // and point clouds carry it as well (the point cloud header stamp in
+    // microseconds of the steady clock); VRPN stamps every object with the
+    // time of its own sample.
+    std::chrono::steady_clock::time_point captureTime() const;
+
+    // maps the device clock onto the host clock; invalid for backends
+    // without device time stamps
+    const ClockOffsetEstimator& clockOffset() const;
+
     // returns reference to objects available in the current frame
     virtual void getObjects(std::vector<Object>& result) const = 0;
 
@@ -115,6 +225,21 @@ namespace libmotioncapture {
     virtual void getLatency(
       std::vector<LatencyInfo>& result) const = 0;
 
+    // Object table: resolve names once, then query poses in O(1)
+
+    // the same name always maps to the same handle, even if the object is
+    // not (yet) part of the stream
+    ObjectHandle objectHandle(const std::string& name);
+
+    const std::string& objectName(ObjectHandle handle) const;
+
+    // pose in the current frame; returns false if the object is occluded or
+    // not part of the frame
+    bool getObjectPose(
+      ObjectHandle handle,
+      Eigen::Vector3f& position,
+      Eigen::Quaternionf& rotation) const;
+
     // Query API capabilities
 
     // return true, if tracking of objects is supported
@@ -123,6 +248,77 @@ namespace libmotioncapture {
     virtual bool supportsLatencyEstimate() const = 0;
     // returns true if raw point cloud is available
     virtual bool supportsPointCloud() const = 0;
+    // returns true if getReceiveStatistics() is implemented
+    virtual bool supportsReceiveStatistics() const;
+
+    // safe to call from any thread
+    virtual void getReceiveStatistics(
+      ReceiveStatistics& result) const;
+
+    // Asynchronous mode
+
+    // starts a thread that receives and decodes every frame in the
+    // background. While it runs, use latestFrame() instead of the methods
+    // above.
+    void startReceiveThread();
+
+    // waits for the current waitForNextFrame() call to return, which takes
+    // at most receivePollInterval (up to a second for Vicon, whose SDK
+    // blocks that long)
+    void stopReceiveThread();
+
+    static const std::chrono::milliseconds receivePollInterval;
+
+    // Returns the newest complete frame without blocking, or nullptr if none
+    // was received yet. The frame stays valid until the next call. For a
+    // single consumer thread only; rethrows errors of the receive thread.
+    const Frame* latestFrame();
+
+  protected:
+    // implementations call this whenever a new frame was received
+    void invalidateObjectTable();
+
+    // How long waitForNextFrame() may block before throwing FrameTimeout:
+    // frameTimeout(), but no longer than receivePollInterval while the
+    // receive thread runs, so it can be stopped. Implementations use this
+    // instead of frameTimeout(); 0 waits forever.
+    std::chrono::milliseconds waitTimeout() const;
+
+    // implementations call this once per frame in waitForNextFrame()
+    void setCaptureTime(std::chrono::steady_clock::time_point time);
+
+    // fed by the implementation with the device time stamp of every frame
+    ClockOffsetEstimator& clockOffsetEstimator();
+
+    // set the capture time of the current frame on query results
+    void stampCaptureTime(Object& object) const;
+    void stampCaptureTime(std::vector<Object>& objects) const;
+    void stampCaptureTime(pcl::PointCloud<pcl::PointXYZ>& pointCloud) const;
+
+    // Called once per frame on the first getObjectPose(); fills in the poses
+    // of the resolved handles with setObjectPose(). The default goes through
+    // getObjects() with one hash lookup per object.
+    virtual void updateObjectTable() const;
+
+    size_t objectHandleCount() const;
+
+    // looks up a name without adding it
+    bool findObjectHandle(
+      const std::string& name,
+      ObjectHandle& handle) const;
+
+    void setObjectPose(
+      ObjectHandle handle,
+      const Eigen::Vector3f& position,
+      const Eigen::Quaternionf& rotation) const;
+
+  private:
+    std::chrono::milliseconds m_frameTimeout;
+    std::chrono::steady_clock::time_point m_captureTime;
+    ClockOffsetEstimator m_clockOffset;
+    // not copyable: the receive thread refers to this instance
+    std::unique_ptr<MotionCaptureReceiver> m_receiver;
+    std::unique_ptr<MotionCaptureObjectTable> m_objectTable;
   };
 
 } // namespace libobjecttracker
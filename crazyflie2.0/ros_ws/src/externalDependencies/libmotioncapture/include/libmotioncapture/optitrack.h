@@ -6,9 +6,15 @@ namespace libmotioncapture {
 
   class MotionCaptureOptitrack : public MotionCapture{
   public:
+    // bufferSize: decoded frames kept for waitForNextFrame()
+    // latestOnly: waitForNextFrame() hands out the newest frame and counts
+    // the older ones as overflows; otherwise the oldest, so that no frame is
+    // skipped, at the cost of up to bufferSize frames of lag
     MotionCaptureOptitrack(
       const std::string& localIp,
-      const std::string& serverIp);
+      const std::string& serverIp,
+      size_t bufferSize = 4,
+      bool latestOnly = true);
 
     virtual ~MotionCaptureOptitrack();
 
@@ -26,6 +32,10 @@ namespace libmotioncapture {
     virtual bool supportsObjectTracking() const;
     virtual bool supportsLatencyEstimate() const;
     virtual bool supportsPointCloud() const;
+    virtual bool supportsReceiveStatistics() const;
+
+    virtual void getReceiveStatistics(
+      ReceiveStatistics& result) const;
 
   private:
     MotionCaptureOptitrackImpl * pImpl;
@@ -0,0 +1,61 @@
+#pragma once
+#include "libmotioncapture/motioncapture.h"
+
+namespace libmotioncapture {
+
+  class PoseHistoryImpl;
+
+  // Recent poses of every object, for consumers that sample at their own
+  // rate. One thread feeds it with update(); any number of threads query
+  // getPose() without locks. A query near the newest sample takes a single
+  // step, older ones a binary search over the capacity.
+  class PoseHistory
+  {
+  public:
+    // capacity: samples per object; maxObjects: fixed, so the read path
+    // never sees a reallocation
+    PoseHistory(
+      size_t capacity = 32,
+      size_t maxObjects = 256);
+
+    ~PoseHistory();
+
+    PoseHistory(const PoseHistory&) = delete;
+    PoseHistory& operator=(const PoseHistory&) = delete;
+
+    // Resolves a name once; objects seen by update() are added on their own.
+    // Thread safe, but takes a lock. Throws std::runtime_error if more than
+    // maxObjects names are used.
+    ObjectHandle handle(const std::string& name);
+
+    // how far getPose() may predict beyond the newest sample (default 0.1 s)
+    void setMaxExtrapolation(std::chrono::duration<double> time);
+
+    // Writer: call after waitForNextFrame(), or with latestFrame()->objects.
+    // Occluded objects and samples not newer than the last one are skipped.
+    void update(const MotionCapture& mocap);
+    void update(const std::vector<Object>& objects);
+
+    // Pose at a time on the host's steady clock: interpolated (SLERP)
+    // between two samples, or extrapolated with the twist of the last two.
+    // Returns false if there is no sample, the time is older than the
+    // history or too far in the future.
+    bool getPose(
+      ObjectHandle handle,
+      std::chrono::steady_clock::time_point time,
+      Eigen::Vector3f& position,
+      Eigen::Quaternionf& rotation) const;
+
+    // the newest sample; returns false if there is none
+    bool getLatestPose(
+      ObjectHandle handle,
+      std::chrono::steady_clock::time_point& time,
+      Eigen::Vector3f& position,
+      Eigen::Quaternionf& rotation) const;
+
+  private:
+    PoseHistoryImpl* pImpl;
+  };
+
+} // namespace libobjecttracker
+
@@ -9,11 +9,14 @@ namespace libmotioncapture {
     : public MotionCapture
   {
   public:
+    // enableStreaming: QTM pushes every frame over UDP to a background
+    // receiver; otherwise every frame is requested over TCP
     MotionCaptureQualisys(
       const std::string& hostname,
       int basePort,
       bool enableObjects,
-      bool enablePointcloud);
+      bool enablePointcloud,
+      bool enableStreaming = true);
 
     virtual ~MotionCaptureQualisys();
 
@@ -34,6 +37,9 @@ namespace libmotioncapture {
     virtual bool supportsLatencyEstimate() const;
     virtual bool supportsPointCloud() const;
 
+  protected:
+    virtual void updateObjectTable() const;
+
   private:
     MotionCaptureQualisysImpl* pImpl;
   };
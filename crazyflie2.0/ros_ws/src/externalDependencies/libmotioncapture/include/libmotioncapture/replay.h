@@ -0,0 +1,106 @@
+#pragma once
+#include "libmotioncapture/motioncapture.h"
+
+#include <cstdio>
+
+namespace libmotioncapture {
+
+  // synthetic swarm for load tests: vehicles flying circles on a grid
+  struct SyntheticSwarmConfig
+  {
+    SyntheticSwarmConfig();
+
+    // objects are named cf1 ... cfN
+    size_t vehicles;
+    double frameRate; // Hz
+    double duration;  // s, 0 for endless
+    // markers in the body frame of every vehicle
+    std::vector<Eigen::Vector3f> markers;
+    float spacing;    // m, between the grid cells
+    float radius;     // m, of the circles
+    float height;     // m
+    float angularVelocity; // rad/s, along the circle
+    float markerNoise;     // m, standard deviation per axis
+    // probability of a marker to be missing in a frame
+    float dropoutProbability;
+    // reflections per frame that belong to no vehicle
+    size_t spuriousMarkers;
+    unsigned int seed;
+  };
+
+  class MotionCaptureReplayImpl;
+
+  // Plays back a stream recorded with MotionCaptureRecorder, or generates
+  // one, without network or vendor SDK. waitForNextFrame() throws
+  // EndOfStream at the end of the stream.
+  class MotionCaptureReplay
+    : public MotionCapture
+  {
+  public:
+    // realtime: keep the recorded frame timing, otherwise play as fast as
+    // possible; loop: start over at the end
+    MotionCaptureReplay(
+      const std::string& filename,
+      bool realtime,
+      bool loop);
+
+    MotionCaptureReplay(
+      const SyntheticSwarmConfig& config,
+      bool realtime);
+
+    virtual ~MotionCaptureReplay();
+
+    // time stamp of the current frame in the stream
+    std::chrono::microseconds frameTime() const;
+
+    // implementations for MotionCapture interface
+    virtual void waitForNextFrame();
+    virtual void getObjects(std::vector<Object>& result) const;
+    virtual void getPointCloud(
+      pcl::PointCloud<pcl::PointXYZ>::Ptr result) const;
+    virtual void getLatency(
+      std::vector<LatencyInfo>& result) const;
+
+    virtual bool supportsObjectTracking() const;
+    virtual bool supportsLatencyEstimate() const;
+    virtual bool supportsPointCloud() const;
+
+  private:
+    MotionCaptureReplayImpl* pImpl;
+  };
+
+  // Records the current frame of any backend for MotionCaptureReplay.
+  //
+  // file format (native byte order):
+  // header : magic "MCREPLAY" (8 bytes), version : uint32, reserved : uint32
+  // frames : timestamp (microseconds) : uint64
+  //          object count : uint32, marker count : uint32
+  //          per object: name length : uint32, name, occluded : uint32,
+  //                      x y z qw qx qy qz : float32
+  //          [x y z, x y z, ... ] : float32
+  class MotionCaptureRecorder
+  {
+  public:
+    MotionCaptureRecorder(
+      const std::string& filename);
+
+    ~MotionCaptureRecorder();
+
+    // call after waitForNextFrame(); stamps the frame with the time since
+    // the first recorded frame
+    void record(const MotionCapture& mocap);
+
+    // with an explicit time stamp, e.g. MotionCaptureReplay::frameTime()
+    void record(
+      const MotionCapture& mocap,
+      std::chrono::microseconds time);
+
+  private:
+    FILE* m_file;
+    std::chrono::steady_clock::time_point m_start;
+    std::vector<Object> m_objects;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr m_pointCloud;
+  };
+
+} // namespace libobjecttracker
+
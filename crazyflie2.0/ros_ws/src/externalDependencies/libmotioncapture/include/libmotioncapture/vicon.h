@@ -46,6 +46,9 @@ namespace libmotioncapture {
     virtual bool supportsLatencyEstimate() const;
     virtual bool supportsPointCloud() const;
 
+  protected:
+    virtual void updateObjectTable() const;
+
   private:
     MotionCaptureViconImpl* pImpl;
   };
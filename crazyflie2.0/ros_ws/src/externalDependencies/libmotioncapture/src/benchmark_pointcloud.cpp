@@ -0,0 +1,125 @@
+// Micro-benchmark of the point cloud conversion in the backends: the
+// previous clear() + push_back() per marker against filling a reused cloud
+// and converting units and axes in one pass. Uses synthetic markers, so no
+// motion capture system is needed.
+//
+// usage: motioncapture_pointcloud_benchmark [markers] [rate Hz] [seconds]
+#include "point_cloud_buffer.h"
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace libmotioncapture;
+
+typedef pcl::PointCloud<pcl::PointXYZ> Cloud;
+
+// stand-in for an SDK that returns one marker per call (Vicon, Qualisys)
+struct MarkerSource
+{
+  std::vector<float> xyz; // mm
+
+  void get(size_t i, float& x, float& y, float& z) const
+  {
+    x = xyz[3 * i];
+    y = xyz[3 * i + 1];
+    z = xyz[3 * i + 2];
+  }
+};
+
+static void perMarkerPushBack(const MarkerSource& source, size_t count, Cloud& result)
+{
+  result.clear();
+  for (size_t i = 0; i < count; ++i) {
+    float x, y, z;
+    source.get(i, x, y, z);
+    result.push_back(pcl::PointXYZ(x / 1000.0, y / 1000.0, z / 1000.0));
+  }
+}
+
+static void perMarkerBuffer(const MarkerSource& source, size_t count, Cloud& result)
+{
+  PointCloudCoordinates points = resizePointCloud(result, count);
+  for (size_t i = 0; i < count; ++i) {
+    source.get(i, points(0, i), points(1, i), points(2, i));
+  }
+  points *= 0.001f;
+}
+
+// packed array with an axis remap (OptiTrack)
+static void packedPushBack(const std::vector<float>& xyz, size_t count, Cloud& result)
+{
+  int const order[3] = {1, 0, 2};
+  float const multiplier[3] = {-1, 1, 1};
+  result.clear();
+  for (size_t i = 0; i < count; ++i) {
+    const float* p = &xyz[3 * i];
+    result.push_back(pcl::PointXYZ(
+      p[order[0]] * multiplier[0],
+      p[order[1]] * multiplier[1],
+      p[order[2]] * multiplier[2]));
+  }
+}
+
+static void packedBuffer(const std::vector<float>& xyz, size_t count, Cloud& result)
+{
+  Eigen::Matrix3f axisTransform;
+  axisTransform << 0, -1, 0,
+                   1,  0, 0,
+                   0,  0, 1;
+  PointCloudCoordinates points = resizePointCloud(result, count);
+  points.noalias() = axisTransform * PackedCoordinates(xyz.data(), 3, count);
+}
+
+static double run(
+  const std::string& name,
+  std::function<void(Cloud&)> convert,
+  size_t frames,
+  double framePeriod)
+{
+  Cloud cloud;
+  float checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < frames; ++i) {
+    convert(cloud);
+    checksum += cloud.points.back().x;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double perFrame = seconds / frames;
+  std::cout << std::fixed << std::setprecision(3)
+            << "  " << std::left << std::setw(24) << name << std::right
+            << 1e6 * perFrame << " us/frame, "
+            << 100 * perFrame / framePeriod << "% of the frame period"
+            << " (checksum " << checksum << ")\n";
+  return perFrame;
+}
+
+int main(int argc, char **argv)
+{
+  size_t markers = argc > 1 ? std::stoul(argv[1]) : 200;
+  double rate = argc > 2 ? std::stod(argv[2]) : 300;
+  double duration = argc > 3 ? std::stod(argv[3]) : 60;
+  size_t frames = rate * duration;
+
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> distribution(-3000, 3000);
+  MarkerSource source;
+  for (size_t i = 0; i < 3 * markers; ++i) {
+    source.xyz.push_back(distribution(generator));
+  }
+
+  std::cout << markers << " markers, " << frames << " frames ("
+            << duration << " s at " << rate << " Hz)\n";
+  std::cout << "per-marker SDK calls, mm to m:\n";
+  double a = run("clear + push_back", [&](Cloud& c) { perMarkerPushBack(source, markers, c); }, frames, 1 / rate);
+  double b = run("reused buffer", [&](Cloud& c) { perMarkerBuffer(source, markers, c); }, frames, 1 / rate);
+  std::cout << "  speedup " << a / b << "x\n";
+  std::cout << "packed array, axis remap:\n";
+  a = run("clear + push_back", [&](Cloud& c) { packedPushBack(source.xyz, markers, c); }, frames, 1 / rate);
+  b = run("reused buffer", [&](Cloud& c) { packedBuffer(source.xyz, markers, c); }, frames, 1 / rate);
+  std::cout << "  speedup " << a / b << "x\n";
+}
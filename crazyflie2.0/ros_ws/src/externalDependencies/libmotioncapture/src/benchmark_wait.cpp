@@ -0,0 +1,114 @@
+// Measures the cost of waiting for frames: process CPU usage while waiting,
+// frame intervals and the time spent inside waitForNextFrame(). Run it on
+// the mocap host against different versions of the library to compare
+// waiting strategies.
+//
+// usage: motioncapture_benchmark <type> <hostname> [seconds] [timeout ms]
+//   type: vicon, vrpn, replay (hostname is a recorded file) or synthetic
+//   (hostname is the number of vehicles)
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libmotioncapture/replay.h"
+#ifdef ENABLE_VICON
+#include "libmotioncapture/vicon.h"
+#endif
+#ifdef ENABLE_VRPN
+#include "libmotioncapture/vrpn.h"
+#endif
+
+using namespace libmotioncapture;
+
+static void printPercentiles(const std::string& name, std::vector<double> t)
+{
+  if (t.empty()) {
+    return;
+  }
+  std::sort(t.begin(), t.end());
+  auto percentile = [&t](double p) {
+    return 1e3 * t[std::min(t.size() - 1, (size_t)(p * t.size()))];
+  };
+  std::cout << "  " << name << " [ms]: p50 " << percentile(0.5)
+            << ", p90 " << percentile(0.9)
+            << ", p99 " << percentile(0.99)
+            << ", max " << 1e3 * t.back() << "\n";
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3) {
+    std::cerr << "usage: " << argv[0] << " <vicon|vrpn|replay|synthetic> <hostname> [seconds] [timeout ms]\n";
+    return -1;
+  }
+  std::string type = argv[1];
+  std::string hostname = argv[2];
+  double duration = argc > 3 ? std::stod(argv[3]) : 10;
+  int timeout = argc > 4 ? std::stoi(argv[4]) : 0;
+
+  std::unique_ptr<MotionCapture> mocap;
+  if (type == "replay") {
+    mocap.reset(new MotionCaptureReplay(hostname, true, true));
+  }
+  if (type == "synthetic") {
+    SyntheticSwarmConfig config;
+    config.vehicles = std::stoul(hostname);
+    mocap.reset(new MotionCaptureReplay(config, true));
+  }
+#ifdef ENABLE_VICON
+  if (type == "vicon") {
+    mocap.reset(new MotionCaptureVicon(hostname, true, true));
+  }
+#endif
+#ifdef ENABLE_VRPN
+  if (type == "vrpn") {
+    mocap.reset(new MotionCaptureVrpn(hostname));
+  }
+#endif
+  if (!mocap) {
+    std::cerr << "error: unsupported motion capture type " << type << "\n";
+    return -1;
+  }
+  mocap->setFrameTimeout(std::chrono::milliseconds(timeout));
+
+  std::vector<double> intervals;
+  std::vector<double> waits;
+  size_t timeouts = 0;
+  std::clock_t cpuStart = std::clock();
+  auto start = std::chrono::steady_clock::now();
+  auto last = start;
+  for (;;) {
+    auto before = std::chrono::steady_clock::now();
+    if (before - start >= std::chrono::duration<double>(duration)) {
+      break;
+    }
+    try {
+      mocap->waitForNextFrame();
+    } catch (const EndOfStream&) {
+      break;
+    } catch (const FrameTimeout&) {
+      ++timeouts;
+      continue;
+    }
+    auto now = std::chrono::steady_clock::now();
+    waits.push_back(std::chrono::duration<double>(now - before).count());
+    if (waits.size() > 1) {
+      intervals.push_back(std::chrono::duration<double>(now - last).count());
+    }
+    last = now;
+  }
+  double cpu = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << std::fixed << std::setprecision(2)
+            << type << ": " << waits.size() << " frames in " << wall << " s"
+            << " (" << waits.size() / wall << " Hz), " << timeouts << " timeouts\n"
+            << "  cpu: " << 100 * cpu / wall << "% of one core\n";
+  printPercentiles("frame interval", intervals);
+  printPercentiles("waitForNextFrame", waits);
+}
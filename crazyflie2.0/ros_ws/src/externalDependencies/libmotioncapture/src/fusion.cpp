@@ -0,0 +1,397 @@
+#include "libmotioncapture/fusion.h"
+#include "libmotioncapture/pose_history.h"
+#include "point_cloud_buffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+namespace libmotioncapture {
+
+  class MotionCaptureFusionImpl
+  {
+  public:
+    // names across all sources; the same for every source's history
+    static const size_t maxObjects = 256;
+
+    struct Source
+    {
+      Source(const FusionSource& config, std::chrono::milliseconds maxAge)
+        : config(config)
+        , rotation(config.rotation)
+        , history(new PoseHistory(32, maxObjects))
+        , thread()
+        , pollTimeout(false)
+        , frames(0)
+        , captureTime()
+        , pointCloud(new pcl::PointCloud<pcl::PointXYZ>)
+        , latency()
+        , errors(0)
+        , timeouts(0)
+        , lastError()
+      {
+        history->setMaxExtrapolation(maxAge);
+      }
+
+      FusionSource config;
+      Eigen::Quaternionf rotation;
+      // written by the receive thread only, read without locks
+      std::unique_ptr<PoseHistory> history;
+      std::thread thread;
+      // the timeout was set by us to wake up regularly, not by the user
+      bool pollTimeout;
+
+      // guarded by mutex
+      uint64_t frames;
+      std::chrono::steady_clock::time_point captureTime;
+      pcl::PointCloud<pcl::PointXYZ>::Ptr pointCloud;
+      std::vector<LatencyInfo> latency;
+      uint64_t errors;
+      uint64_t timeouts;
+      std::string lastError;
+
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    // one thread per source; errors pause the source, not the stream
+    void receive(Source& source)
+    {
+      MotionCapture& mocap = *source.config.mocap;
+      std::vector<Object> objects;
+      pcl::PointCloud<pcl::PointXYZ>::Ptr pointCloud(new pcl::PointCloud<pcl::PointXYZ>);
+      std::vector<LatencyInfo> latency;
+      while (running) {
+        try {
+          mocap.waitForNextFrame();
+          if (mocap.supportsObjectTracking()) {
+            mocap.getObjects(objects);
+            source.history->update(objects);
+          }
+          if (mocap.supportsPointCloud()) {
+            mocap.getPointCloud(pointCloud);
+          }
+          if (mocap.supportsLatencyEstimate()) {
+            mocap.getLatency(latency);
+          }
+        } catch (const EndOfStream&) {
+          // e.g. a replay; its last poses age out
+          break;
+        } catch (const FrameTimeout&) {
+          if (running && !source.pollTimeout) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++source.timeouts;
+          }
+          continue;
+        } catch (std::exception& e) {
+          if (running) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++source.errors;
+            source.lastError = e.what();
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          continue;
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          for (const auto& object : objects) {
+            if (!addObject(object.name())) {
+              ++source.errors;
+              source.lastError = "Too many objects, ignoring " + object.name();
+            }
+          }
+          ++source.frames;
+          source.captureTime = mocap.captureTime();
+          std::swap(source.pointCloud, pointCloud);
+          std::swap(source.latency, latency);
+          ++received;
+        }
+        newFrame.notify_one();
+      }
+    }
+
+    // with mutex held; returns false if there is no room for the name
+    bool addObject(const std::string& name)
+    {
+      if (objectIndices.count(name) > 0) {
+        return true;
+      }
+      if (names.size() >= maxObjects) {
+        return false;
+      }
+      // all handles first, so a failure leaves the indices consistent
+      std::vector<ObjectHandle> sourceHandles;
+      try {
+        for (auto& source : sources) {
+          sourceHandles.push_back(source->history->handle(name));
+        }
+      } catch (const std::runtime_error&) {
+        return false;
+      }
+      objectIndices[name] = names.size();
+      names.push_back(name);
+      handles.insert(handles.end(), sourceHandles.begin(), sourceHandles.end());
+      return true;
+    }
+
+    // with mutex held
+    void fuse()
+    {
+      // the newest frame of all sources defines the time
+      captureTime = std::chrono::steady_clock::time_point();
+      for (const auto& source : sources) {
+        if (source->frames > 0) {
+          captureTime = std::max(captureTime, source->captureTime);
+        }
+      }
+
+      size_t const sourceCount = sources.size();
+      objects.resize(names.size());
+      weights.assign(names.size() * sourceCount, 0.0f);
+      Eigen::Vector3f position;
+      Eigen::Quaternionf rotation;
+      for (size_t i = 0; i < names.size(); ++i) {
+        Eigen::Vector3f positionSum = Eigen::Vector3f::Zero();
+        Eigen::Vector4f rotationSum = Eigen::Vector4f::Zero();
+        float weightSum = 0;
+        for (size_t j = 0; j < sourceCount; ++j) {
+          const Source& source = *sources[j];
+          if (!source.history->getPose(handles[i * sourceCount + j], captureTime, position, rotation)) {
+            continue;
+          }
+          float const weight = source.config.weight;
+          positionSum += weight * (source.config.rotation * position + source.config.translation);
+          Eigen::Vector4f q = (source.rotation * rotation).coeffs();
+          // q and -q are the same rotation; average on one hemisphere
+          if (weightSum > 0 && q.dot(rotationSum) < 0) {
+            q = -q;
+          }
+          rotationSum += weight * q;
+          weightSum += weight;
+          weights[i * sourceCount + j] = weight;
+        }
+        if (weightSum > 0) {
+          Eigen::Quaternionf fused(rotationSum / weightSum);
+          fused.normalize();
+          objects[i] = Object(names[i], positionSum / weightSum, fused);
+          for (size_t j = 0; j < sourceCount; ++j) {
+            weights[i * sourceCount + j] /= weightSum;
+          }
+        } else {
+          objects[i] = Object(names[i]);
+        }
+      }
+
+      // point clouds of recent frames, in world coordinates
+      size_t count = 0;
+      for (const auto& source : sources) {
+        if (isRecent(*source)) {
+          count += source->pointCloud->size();
+        }
+      }
+      PointCloudCoordinates points = resizePointCloud(*pointCloud, count);
+      size_t offset = 0;
+      for (const auto& source : sources) {
+        if (!isRecent(*source) || source->pointCloud->empty()) {
+          continue;
+        }
+        size_t const n = source->pointCloud->size();
+        PointCloudCoordinates sourcePoints(&source->pointCloud->points[0].x, 3, n);
+        points.middleCols(offset, n).noalias() = source->config.rotation * sourcePoints;
+        points.middleCols(offset, n).colwise() += source->config.translation;
+        offset += n;
+      }
+    }
+
+    bool isRecent(const Source& source) const
+    {
+      return source.frames > 0 && captureTime - source.captureTime <= maxAge;
+    }
+
+  public:
+    std::vector<std::unique_ptr<Source> > sources;
+    std::chrono::milliseconds maxAge;
+    std::atomic<bool> running;
+
+    std::mutex mutex;
+    std::condition_variable newFrame;
+    // guarded by mutex
+    uint64_t received;
+    uint64_t consumed;
+    std::unordered_map<std::string, size_t> objectIndices;
+    std::vector<std::string> names;
+    // per object and source
+    std::vector<ObjectHandle> handles;
+
+    // the current frame
+    std::chrono::steady_clock::time_point captureTime;
+    std::vector<Object> objects;
+    std::vector<float> weights;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr pointCloud;
+    std::vector<LatencyInfo> latency;
+  };
+
+  MotionCaptureFusion::MotionCaptureFusion(
+    const std::vector<FusionSource>& sources,
+    std::chrono::milliseconds maxAge)
+  {
+    pImpl = new MotionCaptureFusionImpl;
+    pImpl->maxAge = maxAge;
+    pImpl->running = true;
+    pImpl->received = 0;
+    pImpl->consumed = 0;
+    pImpl->pointCloud.reset(new pcl::PointCloud<pcl::PointXYZ>);
+
+    for (const auto& source : sources) {
+      pImpl->sources.emplace_back(new MotionCaptureFusionImpl::Source(source, maxAge));
+      // wake up regularly, so the receive threads can be stopped
+      if (source.mocap->frameTimeout().count() == 0) {
+        source.mocap->setFrameTimeout(MotionCapture::receivePollInterval);
+        pImpl->sources.back()->pollTimeout = true;
+      }
+    }
+    for (auto& source : pImpl->sources) {
+      source->thread = std::thread(&MotionCaptureFusionImpl::receive, pImpl, std::ref(*source));
+    }
+  }
+
+  MotionCaptureFusion::~MotionCaptureFusion()
+  {
+    stopReceiveThread();
+    pImpl->running = false;
+    for (auto& source : pImpl->sources) {
+      source->thread.join();
+    }
+    for (auto& source : pImpl->sources) {
+      delete source->config.mocap;
+    }
+    delete pImpl;
+  }
+
+  size_t MotionCaptureFusion::sourceCount() const
+  {
+    return pImpl->sources.size();
+  }
+
+  void MotionCaptureFusion::getObjectWeights(
+    std::vector<float>& result) const
+  {
+    result = pImpl->weights;
+  }
+
+  void MotionCaptureFusion::waitForNextFrame()
+  {
+    std::unique_lock<std::mutex> lock(pImpl->mutex);
+    auto newFrame = [this] { return pImpl->received != pImpl->consumed; };
+    auto const timeout = waitTimeout();
+    if (timeout.count() > 0) {
+      if (!pImpl->newFrame.wait_for(lock, timeout, newFrame)) {
+        throw FrameTimeout("Timeout waiting for fused frame");
+      }
+    } else {
+      pImpl->newFrame.wait(lock, newFrame);
+    }
+    pImpl->consumed = pImpl->received;
+    pImpl->fuse();
+
+    pImpl->latency.clear();
+    for (const auto& source : pImpl->sources) {
+      for (const auto& info : source->latency) {
+        std::string name = source->config.name + ": " + info.name();
+        pImpl->latency.emplace_back(LatencyInfo(name, info.value()));
+      }
+      if (source->frames > 0) {
+        std::string age = source->config.name + ": Age";
+        pImpl->latency.emplace_back(LatencyInfo(age, std::chrono::duration<double>(
+          pImpl->captureTime - source->captureTime).count()));
+      }
+      std::string errors = source->config.name + ": Errors";
+      pImpl->latency.emplace_back(LatencyInfo(errors, source->errors));
+      std::string timeouts = source->config.name + ": Timeouts";
+      pImpl->latency.emplace_back(LatencyInfo(timeouts, source->timeouts));
+    }
+    lock.unlock();
+
+    setCaptureTime(pImpl->captureTime);
+    invalidateObjectTable();
+  }
+
+  void MotionCaptureFusion::getObjects(
+    std::vector<Object>& result) const
+  {
+    result = pImpl->objects;
+    stampCaptureTime(result);
+  }
+
+  void MotionCaptureFusion::getPointCloud(
+    pcl::PointCloud<pcl::PointXYZ>::Ptr result) const
+  {
+    *result = *pImpl->pointCloud;
+    stampCaptureTime(*result);
+  }
+
+  void MotionCaptureFusion::getLatency(
+    std::vector<LatencyInfo>& result) const
+  {
+    result = pImpl->latency;
+  }
+
+  bool MotionCaptureFusion::supportsObjectTracking() const
+  {
+    for (const auto& source : pImpl->sources) {
+      if (source->config.mocap->supportsObjectTracking()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool MotionCaptureFusion::supportsLatencyEstimate() const
+  {
+    return true;
+  }
+
+  bool MotionCaptureFusion::supportsPointCloud() const
+  {
+    for (const auto& source : pImpl->sources) {
+      if (source->config.mocap->supportsPointCloud()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool MotionCaptureFusion::supportsReceiveStatistics() const
+  {
+    for (const auto& source : pImpl->sources) {
+      if (source->config.mocap->supportsReceiveStatistics()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void MotionCaptureFusion::getReceiveStatistics(
+    ReceiveStatistics& result) const
+  {
+    result = ReceiveStatistics();
+    ReceiveStatistics statistics;
+    for (const auto& source : pImpl->sources) {
+      if (!source->config.mocap->supportsReceiveStatistics()) {
+        continue;
+      }
+      source->config.mocap->getReceiveStatistics(statistics);
+      result.frames += statistics.frames;
+      result.dropped += statistics.dropped;
+      result.late += statistics.late;
+      result.malformed += statistics.malformed;
+      result.overflows += statistics.overflows;
+    }
+  }
+
+}
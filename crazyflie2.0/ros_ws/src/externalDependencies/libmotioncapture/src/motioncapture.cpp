@@ -1,7 +1,100 @@
 #include "libmotioncapture/motioncapture.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
 namespace libmotioncapture {
 
+  // Triple buffer: the receive thread fills the back slot and swaps it with
+  // the middle one, the consumer swaps the middle slot with the front one if
+  // it holds a newer frame. Neither side ever waits for the other, and the
+  // slots are reused, so frames are decoded without allocating.
+  class MotionCaptureReceiver
+  {
+  public:
+    static const int NewFrame = 4;
+    static const int IndexMask = 3;
+
+    MotionCaptureReceiver()
+      : back(0)
+      , middle(1)
+      , front(2)
+      , running(false)
+      , thread()
+      , threadId()
+      , error()
+      , sequence(0)
+    {
+    }
+
+    Frame frames[3];
+    // owned by the receive thread
+    int back;
+    // slot index, with NewFrame set if not yet seen by the consumer
+    std::atomic<int> middle;
+    // owned by the consumer
+    int front;
+
+    std::atomic<bool> running;
+    std::thread thread;
+    // set by the thread itself, so waitTimeout() knows who calls
+    std::atomic<std::thread::id> threadId;
+    std::exception_ptr error;
+    uint64_t sequence;
+  };
+
+  // Poses indexed by handle. Entries carry the frame they were written in,
+  // so starting a new frame does not touch the table.
+  class MotionCaptureObjectTable
+  {
+  public:
+    struct Entry
+    {
+      std::string name;
+      uint64_t frame;
+      Eigen::Vector3f position;
+      Eigen::Quaternionf rotation;
+
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    MotionCaptureObjectTable()
+      : handles()
+      , entries()
+      , frame(1)
+      , upToDate(false)
+      , objects()
+    {
+    }
+
+    std::unordered_map<std::string, ObjectHandle> handles;
+    std::vector<Entry, Eigen::aligned_allocator<Entry> > entries;
+    uint64_t frame;
+    bool upToDate;
+    // scratch space of the default update
+    std::vector<Object> objects;
+  };
+
+  const std::chrono::milliseconds MotionCapture::receivePollInterval(100);
+
+  MotionCapture::MotionCapture()
+    : m_frameTimeout(0)
+    , m_captureTime()
+    , m_clockOffset()
+    , m_receiver(new MotionCaptureReceiver)
+    , m_objectTable(new MotionCaptureObjectTable)
+  {
+  }
+
+  MotionCapture::~MotionCapture()
+  {
+    stopReceiveThread();
+  }
+
   void MotionCapture::getObjectByName(
       const std::string& name,
       Object& result) const
@@ -17,4 +110,230 @@ namespace libmotioncapture {
     throw std::runtime_error("Object not found!");
   }
 
+  std::chrono::steady_clock::time_point MotionCapture::captureTime() const
+  {
+    return m_captureTime;
+  }
+
+  const ClockOffsetEstimator& MotionCapture::clockOffset() const
+  {
+    return m_clockOffset;
+  }
+
+  void MotionCapture::setCaptureTime(std::chrono::steady_clock::time_point time)
+  {
+    m_captureTime = time;
+  }
+
+  ClockOffsetEstimator& MotionCapture::clockOffsetEstimator()
+  {
+    return m_clockOffset;
+  }
+
+  void MotionCapture::stampCaptureTime(Object& object) const
+  {
+    object.setCaptureTime(m_captureTime);
+  }
+
+  void MotionCapture::stampCaptureTime(std::vector<Object>& objects) const
+  {
+    for (auto& object : objects) {
+      object.setCaptureTime(m_captureTime);
+    }
+  }
+
+  void MotionCapture::stampCaptureTime(pcl::PointCloud<pcl::PointXYZ>& pointCloud) const
+  {
+    pointCloud.header.stamp = std::chrono::duration_cast<std::chrono::microseconds>(
+      m_captureTime.time_since_epoch()).count();
+  }
+
+  bool MotionCapture::supportsReceiveStatistics() const
+  {
+    return false;
+  }
+
+  void MotionCapture::getReceiveStatistics(
+    ReceiveStatistics& result) const
+  {
+    result = ReceiveStatistics();
+  }
+
+  ObjectHandle MotionCapture::objectHandle(const std::string& name)
+  {
+    MotionCaptureObjectTable& table = *m_objectTable;
+    auto result = table.handles.insert(std::make_pair(name, (ObjectHandle)table.entries.size()));
+    if (result.second) {
+      MotionCaptureObjectTable::Entry entry;
+      entry.name = name;
+      entry.frame = 0;
+      table.entries.push_back(entry);
+      // the new handle has no pose in the current frame yet
+      table.upToDate = false;
+    }
+    return result.first->second;
+  }
+
+  const std::string& MotionCapture::objectName(ObjectHandle handle) const
+  {
+    return m_objectTable->entries.at(handle).name;
+  }
+
+  bool MotionCapture::getObjectPose(
+    ObjectHandle handle,
+    Eigen::Vector3f& position,
+    Eigen::Quaternionf& rotation) const
+  {
+    MotionCaptureObjectTable& table = *m_objectTable;
+    if (!table.upToDate) {
+      updateObjectTable();
+      table.upToDate = true;
+    }
+    const MotionCaptureObjectTable::Entry& entry = table.entries.at(handle);
+    if (entry.frame != table.frame) {
+      return false;
+    }
+    position = entry.position;
+    rotation = entry.rotation;
+    return true;
+  }
+
+  void MotionCapture::invalidateObjectTable()
+  {
+    ++m_objectTable->frame;
+    m_objectTable->upToDate = false;
+  }
+
+  void MotionCapture::updateObjectTable() const
+  {
+    std::vector<Object>& objects = m_objectTable->objects;
+    getObjects(objects);
+    ObjectHandle handle;
+    for (const auto& object : objects) {
+      if (!object.occluded() && findObjectHandle(object.name(), handle)) {
+        setObjectPose(handle, object.position(), object.rotation());
+      }
+    }
+  }
+
+  size_t MotionCapture::objectHandleCount() const
+  {
+    return m_objectTable->entries.size();
+  }
+
+  bool MotionCapture::findObjectHandle(
+    const std::string& name,
+    ObjectHandle& handle) const
+  {
+    auto it = m_objectTable->handles.find(name);
+    if (it == m_objectTable->handles.end()) {
+      return false;
+    }
+    handle = it->second;
+    return true;
+  }
+
+  void MotionCapture::setObjectPose(
+    ObjectHandle handle,
+    const Eigen::Vector3f& position,
+    const Eigen::Quaternionf& rotation) const
+  {
+    MotionCaptureObjectTable::Entry& entry = m_objectTable->entries[handle];
+    entry.frame = m_objectTable->frame;
+    entry.position = position;
+    entry.rotation = rotation;
+  }
+
+  void MotionCapture::setFrameTimeout(std::chrono::milliseconds timeout)
+  {
+    m_frameTimeout = timeout;
+  }
+
+  std::chrono::milliseconds MotionCapture::frameTimeout() const
+  {
+    return m_frameTimeout;
+  }
+
+  std::chrono::milliseconds MotionCapture::waitTimeout() const
+  {
+    if (std::this_thread::get_id() != m_receiver->threadId.load()) {
+      return m_frameTimeout;
+    }
+    if (m_frameTimeout.count() > 0) {
+      return std::min(m_frameTimeout, receivePollInterval);
+    }
+    return receivePollInterval;
+  }
+
+  void MotionCapture::startReceiveThread()
+  {
+    if (m_receiver->running) {
+      return;
+    }
+    // a previous thread may have stopped on an error
+    stopReceiveThread();
+    m_receiver->running = true;
+    m_receiver->thread = std::thread([this] {
+      MotionCaptureReceiver& r = *m_receiver;
+      r.threadId = std::this_thread::get_id();
+      try {
+        // the user's timeout spans several bounded waits
+        auto lastFrame = std::chrono::steady_clock::now();
+        while (r.running) {
+          try {
+            waitForNextFrame();
+          } catch (const FrameTimeout&) {
+            if (frameTimeout().count() > 0
+                && std::chrono::steady_clock::now() - lastFrame >= frameTimeout()) {
+              throw;
+            }
+            continue;
+          }
+          lastFrame = std::chrono::steady_clock::now();
+          Frame& frame = r.frames[r.back];
+          frame.receiveTime = std::chrono::steady_clock::now();
+          frame.sequence = ++r.sequence;
+          frame.captureTime = captureTime();
+          if (supportsObjectTracking()) {
+            getObjects(frame.objects);
+          }
+          if (supportsPointCloud()) {
+            getPointCloud(frame.pointCloud);
+          }
+          if (supportsLatencyEstimate()) {
+            getLatency(frame.latency);
+          }
+          r.back = r.middle.exchange(r.back | MotionCaptureReceiver::NewFrame)
+            & MotionCaptureReceiver::IndexMask;
+        }
+      } catch (...) {
+        r.error = std::current_exception();
+        r.running = false;
+      }
+    });
+  }
+
+  void MotionCapture::stopReceiveThread()
+  {
+    m_receiver->running = false;
+    if (m_receiver->thread.joinable()) {
+      m_receiver->thread.join();
+    }
+  }
+
+  const Frame* MotionCapture::latestFrame()
+  {
+    MotionCaptureReceiver& r = *m_receiver;
+    if (r.middle.load() & MotionCaptureReceiver::NewFrame) {
+      r.front = r.middle.exchange(r.front) & MotionCaptureReceiver::IndexMask;
+    }
+    if (!r.running && r.error) {
+      std::exception_ptr error = r.error;
+      r.error = nullptr;
+      std::rethrow_exception(error);
+    }
+    const Frame& frame = r.frames[r.front];
+    return frame.sequence > 0 ? &frame : nullptr;
+  }
+
 }
@@ -1,9 +1,17 @@
 #include "libmotioncapture/optitrack.h"
+#include "point_cloud_buffer.h"
 
 //NatNet
 #include <NatNetLinux/NatNetClient.h>
 #include "NatNetLinux/NatNet.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <poll.h>
+
 namespace libmotioncapture {
 
   class MotionCaptureOptitrackImpl{
@@ -41,23 +49,132 @@ namespace libmotioncapture {
         }
       } 
 
+    // Decodes frames from the data socket into the ring buffer. Frame
+    // numbers are checked for gaps (dropped by the network) and for going
+    // backwards (late or duplicate packets, which are discarded).
+    void receive()
+    {
+      NatNetPacket packet;
+      int const socket = client.getDataSocket();
+      while (receiving) {
+        pollfd fd = {socket, POLLIN, 0};
+        if (poll(&fd, 1, 100) <= 0) {
+          continue;
+        }
+        ssize_t size = read(socket, packet.rawPtr(), packet.maxLength());
+        if (size < 4) {
+          countMalformed();
+          continue;
+        }
+        if (packet.iMessage() != NatNetPacket::NAT_FRAMEOFDATA) {
+          continue;
+        }
+        MocapFrame frame(natNetMajor, natNetMinor);
+        // the payload's counts are checked while it is parsed
+        if (packet.nDataBytes() + 4 != size
+            || !frame.unpack(packet.rawPayloadPtr(), packet.rawPayloadPtr() + packet.nDataBytes())) {
+          countMalformed();
+          continue;
+        }
+        auto now = std::chrono::steady_clock::now();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        // a large step back is a restarted server, not a late packet
+        if (statistics.frames > 0
+            && frame.frameNum() + maxFrameNumberStepBack >= lastFrameNumber) {
+          if (frame.frameNum() <= lastFrameNumber) {
+            ++statistics.late;
+            continue;
+          }
+          statistics.dropped += frame.frameNum() - lastFrameNumber - 1;
+        }
+        lastFrameNumber = frame.frameNum();
+        ++statistics.frames;
+        if (count == frames.size()) {
+          // drop the oldest
+          first = (first + 1) % frames.size();
+          --count;
+          ++statistics.overflows;
+        }
+        ReceivedFrame& slot = frames[(first + count) % frames.size()];
+        slot.frame = frame;
+        slot.receiveTime = now;
+        ++count;
+        lock.unlock();
+        newFrame.notify_one();
+      }
+    }
+
+    void countMalformed()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++statistics.malformed;
+    }
+
+    static const int maxFrameNumberStepBack = 1000;
+
+    struct ReceivedFrame
+    {
+      MocapFrame frame;
+      std::chrono::steady_clock::time_point receiveTime;
+    };
+
   public:
     NatNetClient client;
     std::string version;
-    Point3f axisMultiplier;
-    Point3f axisOrder;
+    unsigned char natNetMajor;
+    unsigned char natNetMinor;
+
+    std::atomic<bool> receiving;
+    std::thread receiver;
+    // ring buffer, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable newFrame;
+    std::vector<ReceivedFrame> frames;
+    size_t first;
+    size_t count;
+    bool latestOnly;
+    int lastFrameNumber;
+    ReceiveStatistics statistics;
+
+    // the frame handed out by waitForNextFrame()
+    MocapFrame currentFrame;
+    std::chrono::steady_clock::time_point currentReceiveTime;
+    // from receiving the current frame until it was handed out, in seconds
+    double queueDelay;
+    bool hasFrame;
+    // new[i] = old[axisOrder[i]] * axisMultiplier[i], as one matrix
+    Eigen::Matrix3f axisTransform;
   };
 
   MotionCaptureOptitrack::MotionCaptureOptitrack(
     const std::string& localIp,
-    const std::string& serverIp)
+    const std::string& serverIp,
+    size_t bufferSize,
+    bool latestOnly)
   {
     pImpl = new MotionCaptureOptitrackImpl;
 
     pImpl->client.connect(localIp, serverIp);
     pImpl->version = pImpl->client.getVersionString();
-    pImpl->axisMultiplier = Point3f(-1, 1, 1);//0.001,0.001,0.001);
-    pImpl->axisOrder = Point3f(1,0,2);
+    pImpl->client.getNatNetVersion(pImpl->natNetMajor, pImpl->natNetMinor);
+    Eigen::Vector3f axisMultiplier(-1, 1, 1);
+    int axisOrder[3] = {1, 0, 2};
+    pImpl->axisTransform.setZero();
+    for (int i = 0; i < 3; ++i) {
+      pImpl->axisTransform(i, axisOrder[i]) = axisMultiplier[i];
+    }
+
+    pImpl->frames.resize(std::max<size_t>(bufferSize, 1));
+    pImpl->first = 0;
+    pImpl->count = 0;
+    pImpl->latestOnly = latestOnly;
+    pImpl->lastFrameNumber = 0;
+    pImpl->currentFrame = MocapFrame(pImpl->natNetMajor, pImpl->natNetMinor);
+    pImpl->hasFrame = false;
+    pImpl->queueDelay = 0;
+    pImpl->receiving = true;
+    pImpl->receiver = std::thread(&MotionCaptureOptitrackImpl::receive, pImpl);
   }
 
   const std::string & MotionCaptureOptitrack::version() const
@@ -67,7 +184,37 @@ namespace libmotioncapture {
 
   void MotionCaptureOptitrack::waitForNextFrame()
   {
-    pImpl->client.update();
+    std::unique_lock<std::mutex> lock(pImpl->mutex);
+    auto available = [this] { return pImpl->count > 0; };
+    auto const timeout = waitTimeout();
+    if (timeout.count() > 0) {
+      if (!pImpl->newFrame.wait_for(lock, timeout, available)) {
+        throw FrameTimeout("Timeout waiting for NatNet frame");
+      }
+    } else {
+      pImpl->newFrame.wait(lock, available);
+    }
+    if (pImpl->latestOnly) {
+      // skip to the newest frame
+      pImpl->statistics.overflows += pImpl->count - 1;
+      pImpl->first = (pImpl->first + pImpl->count - 1) % pImpl->frames.size();
+      pImpl->count = 1;
+    }
+    std::swap(pImpl->currentFrame, pImpl->frames[pImpl->first].frame);
+    pImpl->currentReceiveTime = pImpl->frames[pImpl->first].receiveTime;
+    pImpl->first = (pImpl->first + 1) % pImpl->frames.size();
+    --pImpl->count;
+    pImpl->hasFrame = true;
+    lock.unlock();
+
+    // NatNet 2 frames carry no capture time stamp, only Motive's processing
+    // latency in ms
+    pImpl->queueDelay = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - pImpl->currentReceiveTime).count();
+    setCaptureTime(pImpl->currentReceiveTime
+      - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(pImpl->currentFrame.latency() / 1000.0)));
+    invalidateObjectTable();
   }
 
   void MotionCaptureOptitrack::getObjects(
@@ -76,9 +223,9 @@ namespace libmotioncapture {
     result.clear();
     size_t count = 0;
     
-    if(pImpl->client.isNewFrameReady())
+    if(pImpl->hasFrame)
     {
-      std::vector<RigidBody> const & rBodies = pImpl->client.getLastFrame().rigidBodies();
+      std::vector<RigidBody> const & rBodies = pImpl->currentFrame.rigidBodies();
       count = rBodies.size();
       result.resize(count);
   
@@ -86,35 +233,38 @@ namespace libmotioncapture {
         pImpl->getObjectByRigidbody(rBodies[i], result[i]);
       }
     }
+    stampCaptureTime(result);
   }
 
   void MotionCaptureOptitrack::getPointCloud(
     pcl::PointCloud<pcl::PointXYZ>::Ptr result) const
   {
-    result->clear();
-    std::vector<Point3f> const & markers = pImpl->client.getLastFrame().unIdMarkers();
+    static_assert(sizeof(Point3f) == 3 * sizeof(float), "Point3f is not packed");
+    std::vector<Point3f> const & markers = pImpl->currentFrame.unIdMarkers();
     size_t count = markers.size();
-    for(size_t i=0;i<count;++i) {
-        Point3f p;
-        p.x = markers[i][pImpl->axisOrder.x] * pImpl->axisMultiplier.x;
-        p.y = markers[i][pImpl->axisOrder.y] * pImpl->axisMultiplier.y;
-        p.z = markers[i][pImpl->axisOrder.z] * pImpl->axisMultiplier.z;
-
-        result->push_back(pcl::PointXYZ(p.x,p.y,p.z));
+    PointCloudCoordinates points = resizePointCloud(*result, count);
+    if (count > 0) {
+      points.noalias() = pImpl->axisTransform * PackedCoordinates(&markers[0].x, 3, count);
     }
+    stampCaptureTime(*result);
   }
 
   void MotionCaptureOptitrack::getLatency(
     std::vector<libmotioncapture::LatencyInfo> & result) const
   {
     result.clear();
-    std::string nn = "";
-    double dd = pImpl->client.getLastFrame().latency();
-    result.emplace_back(libmotioncapture::LatencyInfo(nn, dd/1000));
+    std::string processing = "Processing";
+    double dd = pImpl->currentFrame.latency();
+    result.emplace_back(libmotioncapture::LatencyInfo(processing, dd/1000));
+    std::string queue = "Receive queue";
+    result.emplace_back(libmotioncapture::LatencyInfo(queue, pImpl->queueDelay));
   }
 
   MotionCaptureOptitrack::~MotionCaptureOptitrack()
   {
+    stopReceiveThread();
+    pImpl->receiving = false;
+    pImpl->receiver.join();
     delete pImpl;
   }
 
@@ -132,5 +282,17 @@ namespace libmotioncapture {
   {
     return true;
   }
+
+  bool MotionCaptureOptitrack::supportsReceiveStatistics() const
+  {
+    return true;
+  }
+
+  void MotionCaptureOptitrack::getReceiveStatistics(
+    ReceiveStatistics& result) const
+  {
+    std::lock_guard<std::mutex> lock(pImpl->mutex);
+    result = pImpl->statistics;
+  }
 }
 
@@ -71,16 +71,23 @@ namespace libmotioncapture {
 
   MotionCapturePhasespace::~MotionCapturePhasespace()
   {
+    stopReceiveThread();
     owlDone();
     delete pImpl;
   }
 
   void MotionCapturePhasespace::waitForNextFrame()
   {
+    auto const start = std::chrono::steady_clock::now();
+    auto const timeout = waitTimeout();
     std::this_thread::sleep_for(std::chrono::milliseconds(5));
     int n = 0;
     int err;
     do {
+      if (timeout.count() > 0
+          && std::chrono::steady_clock::now() - start >= timeout) {
+        throw FrameTimeout("Timeout waiting for phasespace frame");
+      }
       // get some markers
       n = owlGetMarkers(pImpl->markers.data(), pImpl->markers.size());
         
@@ -114,6 +121,9 @@ namespace libmotioncapture {
 	if (i%2 == 1) {
 	pImpl->markers = temp1;
 	}
+    // no time stamps from the server
+    setCaptureTime(std::chrono::steady_clock::now());
+    invalidateObjectTable();
   }
 
   void MotionCapturePhasespace::getObjects(
@@ -143,6 +153,7 @@ namespace libmotioncapture {
         result.push_back(Object("cf" + std::to_string(id), position, rotation));
       }
     }
+    stampCaptureTime(result);
   }
 
   void MotionCapturePhasespace::getObjectByName(
@@ -150,6 +161,7 @@ namespace libmotioncapture {
     Object& result) const
   {
     result = Object(name);
+    stampCaptureTime(result);
     for (const auto& cf : pImpl->cfs) {
       size_t id = cf.first;
       if (name == "cf" + std::to_string(id)) {      
@@ -172,6 +184,7 @@ namespace libmotioncapture {
             Eigen::AngleAxisf(theta, Eigen::Vector3f::UnitZ()));
 
           result = Object(name, position, rotation);
+          stampCaptureTime(result);
           return;
         }
       } 
@@ -190,6 +203,7 @@ namespace libmotioncapture {
         pImpl->markers[i].y / 1000.0));
       }
     }
+    stampCaptureTime(*result);
   }
 
   void MotionCapturePhasespace::getLatency(
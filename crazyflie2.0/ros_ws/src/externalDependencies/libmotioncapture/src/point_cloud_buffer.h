@@ -0,0 +1,32 @@
+#pragma once
+#include <Eigen/Core>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+namespace libmotioncapture {
+
+  // the coordinates of a point cloud as a 3xN matrix, without copying
+  typedef Eigen::Map<
+    Eigen::Matrix<float, 3, Eigen::Dynamic>,
+    Eigen::Unaligned,
+    Eigen::OuterStride<sizeof(pcl::PointXYZ) / sizeof(float)> > PointCloudCoordinates;
+
+  // densely packed xyz triples, as delivered by most SDKs
+  typedef Eigen::Map<const Eigen::Matrix<float, 3, Eigen::Dynamic> > PackedCoordinates;
+
+  // Sets the size of the cloud, keeping its capacity, and returns its
+  // coordinates for filling in. Backends write raw SDK values first and
+  // convert units and axes afterwards in one pass over the matrix.
+  inline PointCloudCoordinates resizePointCloud(
+    pcl::PointCloud<pcl::PointXYZ>& cloud,
+    size_t count)
+  {
+    cloud.points.resize(count);
+    cloud.width = count;
+    cloud.height = 1;
+    cloud.is_dense = true;
+    return PointCloudCoordinates(count > 0 ? &cloud.points[0].x : nullptr, 3, count);
+  }
+
+} // namespace libmotioncapture
@@ -0,0 +1,294 @@
+#include "libmotioncapture/pose_history.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace libmotioncapture {
+
+  namespace {
+    struct Sample
+    {
+      // nanoseconds of the steady clock
+      int64_t time;
+      float position[3];
+      // w x y z
+      float rotation[4];
+    };
+
+    int64_t toNanoseconds(std::chrono::steady_clock::time_point time)
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        time.time_since_epoch()).count();
+    }
+
+    std::chrono::steady_clock::time_point fromNanoseconds(int64_t time)
+    {
+      return std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::nanoseconds(time)));
+    }
+  }
+
+  // Ring buffer of one object behind a sequence lock: the writer makes the
+  // sequence odd while it changes the buffer, readers copy what they need
+  // and retry if the sequence moved in the meantime.
+  class PoseHistoryTrack
+  {
+  public:
+    explicit PoseHistoryTrack(size_t capacity)
+      : sequence(0)
+      , samples(capacity)
+      , head(0)
+      , count(0)
+      , lastTime(0)
+    {
+    }
+
+    void push(const Sample& sample)
+    {
+      uint32_t s = sequence.load(std::memory_order_relaxed);
+      sequence.store(s + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      size_t const h = head.load(std::memory_order_relaxed);
+      samples[h] = sample;
+      head.store((h + 1) % samples.size(), std::memory_order_relaxed);
+      count.store(std::min(count.load(std::memory_order_relaxed) + 1, samples.size()),
+        std::memory_order_relaxed);
+      sequence.store(s + 2, std::memory_order_release);
+    }
+
+    // Copies the samples around a time: a.time <= time < b.time, or the last
+    // two samples (a older than b) if time is not older than the newest one.
+    // Returns the number of samples copied; 0 if time is too old.
+    size_t find(int64_t time, Sample& a, Sample& b) const
+    {
+      for (;;) {
+        uint32_t s = sequence.load(std::memory_order_acquire);
+        if (s & 1) {
+          continue;
+        }
+        size_t const capacity = samples.size();
+        size_t const n = std::min(count.load(std::memory_order_relaxed), capacity);
+        // i-th sample from the oldest one
+        size_t const oldest = (head.load(std::memory_order_relaxed) + capacity - n) % capacity;
+        auto at = [&](size_t i) -> const Sample& {
+          return samples[(oldest + i) % capacity];
+        };
+        size_t found = 0;
+        if (n > 0) {
+          b = at(n - 1);
+          found = b.time <= time ? 1 : 0;
+          if (n > 1 && b.time <= time) {
+            a = at(n - 2);
+            found = 2;
+          } else if (n > 1 && at(0).time <= time) {
+            // at(lo).time <= time < at(hi).time
+            size_t lo = 0;
+            size_t hi = n - 1;
+            while (hi - lo > 1) {
+              size_t mid = lo + (hi - lo) / 2;
+              if (at(mid).time <= time) {
+                lo = mid;
+              } else {
+                hi = mid;
+              }
+            }
+            a = at(lo);
+            b = at(hi);
+            found = 2;
+          }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) == s) {
+          return found;
+        }
+      }
+    }
+
+    std::atomic<uint32_t> sequence;
+    // written by update() only; head and count are atomic only so that
+    // readers racing with push() are well defined, the sequence orders them
+    std::vector<Sample> samples;
+    std::atomic<size_t> head;
+    std::atomic<size_t> count;
+    int64_t lastTime;
+  };
+
+  class PoseHistoryImpl
+  {
+  public:
+    PoseHistoryImpl(size_t capacity, size_t maxObjects)
+      : capacity(std::max<size_t>(capacity, 2))
+      , tracks(new std::unique_ptr<PoseHistoryTrack>[maxObjects])
+      , maxObjects(maxObjects)
+      , mutex()
+      , handles()
+      , maxExtrapolation(100000000)
+    {
+      // all up front, so readers never see a track being created
+      for (size_t i = 0; i < maxObjects; ++i) {
+        tracks[i].reset(new PoseHistoryTrack(this->capacity));
+      }
+    }
+
+    // with mutex held
+    bool add(const std::string& name, ObjectHandle& handle)
+    {
+      auto it = handles.find(name);
+      if (it != handles.end()) {
+        handle = it->second;
+        return true;
+      }
+      if (handles.size() == maxObjects) {
+        return false;
+      }
+      handle = handles.size();
+      handles[name] = handle;
+      return true;
+    }
+
+    size_t capacity;
+    std::unique_ptr<std::unique_ptr<PoseHistoryTrack>[]> tracks;
+    size_t maxObjects;
+    // guards handles
+    std::mutex mutex;
+    std::unordered_map<std::string, ObjectHandle> handles;
+    // nanoseconds
+    std::atomic<int64_t> maxExtrapolation;
+    // scratch space of update(mocap)
+    std::vector<Object> objects;
+  };
+
+  PoseHistory::PoseHistory(
+    size_t capacity,
+    size_t maxObjects)
+  {
+    pImpl = new PoseHistoryImpl(capacity, maxObjects);
+  }
+
+  PoseHistory::~PoseHistory()
+  {
+    delete pImpl;
+  }
+
+  ObjectHandle PoseHistory::handle(const std::string& name)
+  {
+    std::lock_guard<std::mutex> lock(pImpl->mutex);
+    ObjectHandle result;
+    if (!pImpl->add(name, result)) {
+      throw std::runtime_error("Too many objects in pose history");
+    }
+    return result;
+  }
+
+  void PoseHistory::setMaxExtrapolation(std::chrono::duration<double> time)
+  {
+    pImpl->maxExtrapolation = std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+  }
+
+  void PoseHistory::update(const MotionCapture& mocap)
+  {
+    mocap.getObjects(pImpl->objects);
+    update(pImpl->objects);
+  }
+
+  void PoseHistory::update(const std::vector<Object>& objects)
+  {
+    std::lock_guard<std::mutex> lock(pImpl->mutex);
+    ObjectHandle handle;
+    for (const auto& object : objects) {
+      if (object.occluded() || !pImpl->add(object.name(), handle)) {
+        continue;
+      }
+      PoseHistoryTrack& track = *pImpl->tracks[handle];
+      Sample sample;
+      sample.time = toNanoseconds(object.captureTime());
+      if (track.count.load(std::memory_order_relaxed) > 0 && sample.time <= track.lastTime) {
+        continue;
+      }
+      Eigen::Map<Eigen::Vector3f>(sample.position) = object.position();
+      const Eigen::Quaternionf& q = object.rotation();
+      sample.rotation[0] = q.w();
+      sample.rotation[1] = q.x();
+      sample.rotation[2] = q.y();
+      sample.rotation[3] = q.z();
+      track.push(sample);
+      track.lastTime = sample.time;
+    }
+  }
+
+  bool PoseHistory::getPose(
+    ObjectHandle handle,
+    std::chrono::steady_clock::time_point time,
+    Eigen::Vector3f& position,
+    Eigen::Quaternionf& rotation) const
+  {
+    if (handle >= pImpl->maxObjects) {
+      return false;
+    }
+    int64_t const t = toNanoseconds(time);
+    Sample a, b;
+    size_t found = pImpl->tracks[handle]->find(t, a, b);
+    if (found == 0) {
+      return false;
+    }
+
+    Eigen::Vector3f pb(b.position);
+    Eigen::Quaternionf qb(b.rotation[0], b.rotation[1], b.rotation[2], b.rotation[3]);
+    if (t >= b.time) {
+      // constant twist of the last two samples, in the body frame
+      if (t - b.time > pImpl->maxExtrapolation) {
+        return false;
+      }
+      position = pb;
+      rotation = qb;
+      if (found == 2) {
+        double dt = 1e-9 * (b.time - a.time);
+        double tau = 1e-9 * (t - b.time);
+        Eigen::Vector3f pa(a.position);
+        Eigen::Quaternionf qa(a.rotation[0], a.rotation[1], a.rotation[2], a.rotation[3]);
+        Eigen::Quaternionf delta = qa.conjugate() * qb;
+        if (delta.w() < 0) {
+          delta.coeffs() = -delta.coeffs();
+        }
+        Eigen::AngleAxisf twist(delta);
+        position += (pb - pa) * (tau / dt);
+        rotation = qb * Eigen::Quaternionf(Eigen::AngleAxisf(twist.angle() * tau / dt, twist.axis()));
+        rotation.normalize();
+      }
+      return true;
+    }
+
+    Eigen::Vector3f pa(a.position);
+    Eigen::Quaternionf qa(a.rotation[0], a.rotation[1], a.rotation[2], a.rotation[3]);
+    float s = (float)(t - a.time) / (b.time - a.time);
+    position = pa + s * (pb - pa);
+    rotation = qa.slerp(s, qb);
+    return true;
+  }
+
+  bool PoseHistory::getLatestPose(
+    ObjectHandle handle,
+    std::chrono::steady_clock::time_point& time,
+    Eigen::Vector3f& position,
+    Eigen::Quaternionf& rotation) const
+  {
+    if (handle >= pImpl->maxObjects) {
+      return false;
+    }
+    Sample a, b;
+    if (pImpl->tracks[handle]->find(std::numeric_limits<int64_t>::max(), a, b) == 0) {
+      return false;
+    }
+    time = fromNanoseconds(b.time);
+    position = Eigen::Vector3f(b.position);
+    rotation = Eigen::Quaternionf(b.rotation[0], b.rotation[1], b.rotation[2], b.rotation[3]);
+    return true;
+  }
+
+}
@@ -1,29 +1,146 @@
 #include "libmotioncapture/qualisys.h"
+#include "point_cloud_buffer.h"
 
 // Qualisys
 #include "RTProtocol.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 namespace libmotioncapture {
 
   class MotionCaptureQualisysImpl
   {
+  public:
+    MotionCaptureQualisysImpl()
+      : pRTPacket(nullptr)
+      , streaming(false)
+      , udpSocket(-1)
+      , receiving(false)
+      , receivedCount(0)
+      , consumedCount(0)
+      , localDelay(0)
+    {
+    }
+
+    // also cleans up after a failed construction
+    ~MotionCaptureQualisysImpl()
+    {
+      if (streaming) {
+        poRTProtocol.StreamFramesStop();
+      }
+      receiving = false;
+      if (receiver.joinable()) {
+        receiver.join();
+      }
+      if (udpSocket >= 0) {
+        close(udpSocket);
+      }
+      if (poRTProtocol.Connected()) {
+        poRTProtocol.Disconnect();
+      }
+    }
+
+    // returns false if the body is not tracked in the current frame
+    bool getBody(
+      size_t bodyId,
+      Eigen::Vector3f& position,
+      Eigen::Quaternionf& quaternion)
+    {
+      float pos[3], rx, ry, rz;
+      if (bodyId >= pRTPacket->Get6DOFEulerBodyCount()
+          || !pRTPacket->Get6DOFEulerBody(bodyId, pos[0], pos[1], pos[2], rx, ry, rz)
+          || std::isnan(pos[0])) {
+        return false;
+      }
+
+      position = Eigen::Vector3f(pos) / 1000.0;
+
+      Eigen::Matrix3f rotation;
+      rotation = Eigen::AngleAxisf((rx/180.0f)*M_PI, Eigen::Vector3f::UnitX())
+               * Eigen::AngleAxisf((ry/180.0f)*M_PI, Eigen::Vector3f::UnitY())
+               * Eigen::AngleAxisf((rz/180.0f)*M_PI, Eigen::Vector3f::UnitZ());
+      quaternion = Eigen::Quaternionf(rotation);
+      return true;
+    }
+
+    // keeps only the newest datagram; waitForNextFrame() takes it from here
+    void receive()
+    {
+      std::vector<char> buffer(65536);
+      while (receiving) {
+        pollfd fd = {udpSocket, POLLIN, 0};
+        if (poll(&fd, 1, 100) <= 0) {
+          continue;
+        }
+        ssize_t size = recv(udpSocket, buffer.data(), buffer.size(), 0);
+        auto now = std::chrono::steady_clock::now();
+        if (size < 24 || CRTPacket::GetType(buffer.data()) != CRTPacket::PacketData) {
+          continue;
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          received.assign(buffer.data(), buffer.data() + size);
+          receivedTime = now;
+          ++receivedCount;
+        }
+        newPacket.notify_one();
+      }
+    }
+
   public:
     CRTProtocol poRTProtocol;
     CRTPacket*  pRTPacket;
     CRTProtocol::EComponentType componentType;
     std::string version;
+    // from the 6DOF settings, which do not change while streaming
+    std::unordered_map<std::string, size_t> bodyIds;
+    // body of each object handle, -1 if unknown
+    std::vector<int> handleBodyIds;
+
+    // UDP streaming
+    bool streaming;
+    int udpSocket;
+    std::atomic<bool> receiving;
+    std::thread receiver;
+    std::mutex mutex;
+    std::condition_variable newPacket;
+    // guarded by mutex
+    std::vector<char> received;
+    std::chrono::steady_clock::time_point receivedTime;
+    uint64_t receivedCount;
+    // the current frame
+    uint64_t consumedCount;
+    std::vector<char> current;
+    std::unique_ptr<CRTPacket> packet;
+
+    // latency of the current frame, in seconds; streaming: from the datagram
+    // arriving until the frame was handed out; polling: request round trip
+    double localDelay;
   };
 
   MotionCaptureQualisys::MotionCaptureQualisys(
     const std::string& hostname,
     int basePort,
     bool enableObjects,
-    bool enablePointcloud)
+    bool enablePointcloud,
+    bool enableStreaming)
   {
-    pImpl = new MotionCaptureQualisysImpl;
+    // owned here until construction succeeded
+    std::unique_ptr<MotionCaptureQualisysImpl> impl(new MotionCaptureQualisysImpl);
+    pImpl = impl.get();
 
     // Connecting ...
     if (!pImpl->poRTProtocol.Connect((char*)hostname.c_str(), basePort, 0, 1, 7)) {
@@ -44,8 +161,31 @@ namespace libmotioncapture {
 
     // Get 6DOF settings
     pImpl->poRTProtocol.Read6DOFSettings();
+    for (size_t i = 0; i < pImpl->poRTProtocol.Get6DOFBodyCount(); ++i) {
+      pImpl->bodyIds[pImpl->poRTProtocol.Get6DOFBodyName(i)] = i;
+    }
 
-    // TODO: enable UDP streaming of selected component for lower latency?
+    if (enableStreaming) {
+      // let the OS pick the port; QTM sends to the address of this client
+      pImpl->udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+      sockaddr_in address = {};
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_ANY);
+      address.sin_port = 0;
+      socklen_t length = sizeof(address);
+      if (pImpl->udpSocket < 0
+          || bind(pImpl->udpSocket, (sockaddr*)&address, sizeof(address)) != 0
+          || getsockname(pImpl->udpSocket, (sockaddr*)&address, &length) != 0) {
+        throw std::runtime_error("Error creating UDP socket for QTM streaming");
+      }
+      if (!pImpl->poRTProtocol.StreamFrames(CRTProtocol::RateAllFrames, 0,
+            ntohs(address.sin_port), NULL, pImpl->componentType)) {
+        throw std::runtime_error("Error starting QTM streaming");
+      }
+      pImpl->streaming = true;
+      pImpl->packet.reset(new CRTPacket(1, 7, false));
+      pImpl->pRTPacket = pImpl->packet.get();
+    }
 
     // Getting version
     char qtmVersion[255];
@@ -55,10 +195,17 @@ namespace libmotioncapture {
     std::stringstream sstr;
     sstr << qtmVersion << " (Protocol: " << major << "." << minor <<")";
     pImpl->version  = sstr.str();
+
+    if (pImpl->streaming) {
+      pImpl->receiving = true;
+      pImpl->receiver = std::thread(&MotionCaptureQualisysImpl::receive, pImpl);
+    }
+    impl.release();
   }
 
   MotionCaptureQualisys::~MotionCaptureQualisys()
   {
+    stopReceiveThread();
     delete pImpl;
   }
 
@@ -69,99 +216,130 @@ namespace libmotioncapture {
 
   void MotionCaptureQualisys::waitForNextFrame()
   {
-    CRTPacket::EPacketType eType;
-
-    pImpl->poRTProtocol.GetCurrentFrame(pImpl->componentType);
-
-    do {
-      pImpl->poRTProtocol.ReceiveRTPacket(eType, true);
-    } while(eType != CRTPacket::PacketData);
+    std::chrono::steady_clock::time_point receiveTime;
+    if (pImpl->streaming) {
+      std::unique_lock<std::mutex> lock(pImpl->mutex);
+      auto newFrame = [this] { return pImpl->receivedCount != pImpl->consumedCount; };
+      auto const timeout = waitTimeout();
+      if (timeout.count() > 0) {
+        if (!pImpl->newPacket.wait_for(lock, timeout, newFrame)) {
+          throw FrameTimeout("Timeout waiting for QTM frame");
+        }
+      } else {
+        pImpl->newPacket.wait(lock, newFrame);
+      }
+      pImpl->current.swap(pImpl->received);
+      pImpl->consumedCount = pImpl->receivedCount;
+      receiveTime = pImpl->receivedTime;
+      lock.unlock();
+
+      pImpl->packet->SetData(pImpl->current.data());
+      pImpl->localDelay = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - receiveTime).count();
+    } else {
+      CRTPacket::EPacketType eType;
+
+      auto requestTime = std::chrono::steady_clock::now();
+      pImpl->poRTProtocol.GetCurrentFrame(pImpl->componentType);
+
+      auto const timeout = waitTimeout();
+      do {
+        int wait = WAIT_FOR_DATA_TIMEOUT;
+        if (timeout.count() > 0) {
+          auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+            requestTime + timeout - std::chrono::steady_clock::now());
+          if (remaining.count() <= 0) {
+            throw FrameTimeout("Timeout waiting for QTM frame");
+          }
+          wait = std::min<int64_t>(wait, remaining.count());
+        }
+        pImpl->poRTProtocol.ReceiveRTPacket(eType, true, wait);
+      } while(eType != CRTPacket::PacketData);
+      receiveTime = std::chrono::steady_clock::now();
+      pImpl->localDelay = std::chrono::duration<double>(receiveTime - requestTime).count();
+    }
+    // QTM's capture clock and ours share no epoch
+    double const deviceTime = pImpl->pRTPacket->GetTimeStamp() / 1e6;
+    clockOffsetEstimator().update(deviceTime, receiveTime);
+    setCaptureTime(clockOffset().toHost(deviceTime));
+    invalidateObjectTable();
   }
 
   void MotionCaptureQualisys::getObjects(
     std::vector<Object>& result) const
   {
-    float pos[3], rx, ry, rz;
-
     result.clear();
     size_t count = pImpl->pRTPacket->Get6DOFEulerBodyCount();
 
+    Eigen::Vector3f position;
+    Eigen::Quaternionf quaternion;
     for(size_t i = 0; i < count; ++i) {
-      pImpl->pRTPacket->Get6DOFEulerBody(i, pos[0], pos[1], pos[2], rx, ry, rz);
-      if (std::isnan(pos[0])) {
-        result.push_back(Object(std::string(pImpl->poRTProtocol.Get6DOFBodyName(i))));
-      } else {
-        std::string name = std::string(pImpl->poRTProtocol.Get6DOFBodyName(i));
-
-        Eigen::Vector3f position = Eigen::Vector3f(pos) / 1000.0;
-
-        Eigen::Matrix3f rotation;
-        rotation = Eigen::AngleAxisf((rx/180.0f)*M_PI, Eigen::Vector3f::UnitX())
-                 * Eigen::AngleAxisf((ry/180.0f)*M_PI, Eigen::Vector3f::UnitY())
-                 * Eigen::AngleAxisf((rz/180.0f)*M_PI, Eigen::Vector3f::UnitZ());
-        Eigen::Quaternionf quaternion = Eigen::Quaternionf(rotation);
-
+      std::string name = std::string(pImpl->poRTProtocol.Get6DOFBodyName(i));
+      if (pImpl->getBody(i, position, quaternion)) {
         result.push_back(Object(name, position, quaternion));
+      } else {
+        result.push_back(Object(name));
       }
     }
+    stampCaptureTime(result);
   }
 
   void MotionCaptureQualisys::getObjectByName(
     const std::string& name,
     Object& result) const
   {
-    // Find object index
-    size_t bodyCount = pImpl->pRTPacket->Get6DOFEulerBodyCount();
-    size_t bodyId;
-    for (bodyId = 0; bodyId < bodyCount; ++bodyId) {
-      if (!strcmp(name.c_str(), pImpl->poRTProtocol.Get6DOFBodyName(bodyId))) {
-        break;
-      }
+    Eigen::Vector3f position;
+    Eigen::Quaternionf quaternion;
+    auto bodyId = pImpl->bodyIds.find(name);
+    if (bodyId != pImpl->bodyIds.end()
+        && pImpl->getBody(bodyId->second, position, quaternion)) {
+      result = Object(name, position, quaternion);
+    } else {
+      result = Object(name);
     }
+    stampCaptureTime(result);
+  }
 
-    // If found, get object position
-    if (bodyId < bodyCount) {
-      float pos[3], rx, ry, rz;
-
-      pImpl->pRTPacket->Get6DOFEulerBody(bodyId, pos[0], pos[1], pos[2], rx, ry, rz);
-
-      if (std::isnan(pos[0])) {
-        result = Object(name);
-      } else {
-        Eigen::Vector3f position = Eigen::Vector3f(pos) / 1000.0;
-
-        Eigen::Matrix3f rotation;
-        rotation = Eigen::AngleAxisf((rx/180.0f)*M_PI, Eigen::Vector3f::UnitX())
-                 * Eigen::AngleAxisf((ry/180.0f)*M_PI, Eigen::Vector3f::UnitY())
-                 * Eigen::AngleAxisf((rz/180.0f)*M_PI, Eigen::Vector3f::UnitZ());
-        Eigen::Quaternionf quaternion = Eigen::Quaternionf(rotation);
+  void MotionCaptureQualisys::updateObjectTable() const
+  {
+    // resolve new handles once
+    while (pImpl->handleBodyIds.size() < objectHandleCount()) {
+      auto bodyId = pImpl->bodyIds.find(objectName(pImpl->handleBodyIds.size()));
+      pImpl->handleBodyIds.push_back(bodyId != pImpl->bodyIds.end() ? bodyId->second : -1);
+    }
 
-        result = Object(name, position, quaternion);
+    Eigen::Vector3f position;
+    Eigen::Quaternionf quaternion;
+    for (ObjectHandle handle = 0; handle < pImpl->handleBodyIds.size(); ++handle) {
+      int bodyId = pImpl->handleBodyIds[handle];
+      if (bodyId >= 0 && pImpl->getBody(bodyId, position, quaternion)) {
+        setObjectPose(handle, position, quaternion);
       }
-    } else {
-      result = Object(name);
     }
   }
 
   void MotionCaptureQualisys::getPointCloud(
     pcl::PointCloud<pcl::PointXYZ>::Ptr result) const
   {
-    result->clear();
     size_t count = pImpl->pRTPacket->Get3DNoLabelsMarkerCount();
+    PointCloudCoordinates points = resizePointCloud(*result, count);
     for(size_t i = 0; i < count; ++i) {
-      float x, y, z;
       uint nId;
-      pImpl->pRTPacket->Get3DNoLabelsMarker(i, x, y, z, nId);
-      result->push_back(pcl::PointXYZ(x / 1000.0,
-                                      y / 1000.0,
-                                      z / 1000.0));
+      pImpl->pRTPacket->Get3DNoLabelsMarker(i, points(0, i), points(1, i), points(2, i), nId);
     }
+    // mm to m
+    points *= 0.001f;
+    stampCaptureTime(*result);
   }
 
   void MotionCaptureQualisys::getLatency(
     std::vector<LatencyInfo>& result) const
   {
     result.clear();
+    std::string transport = "Transport";
+    result.emplace_back(LatencyInfo(transport, clockOffset().delay()));
+    std::string local = pImpl->streaming ? "Receive queue" : "Request round trip";
+    result.emplace_back(LatencyInfo(local, pImpl->localDelay));
   }
 
   bool MotionCaptureQualisys::supportsObjectTracking() const
@@ -171,7 +349,7 @@ namespace libmotioncapture {
 
   bool MotionCaptureQualisys::supportsLatencyEstimate() const
   {
-    return false;
+    return true;
   }
 
   bool MotionCaptureQualisys::supportsPointCloud() const
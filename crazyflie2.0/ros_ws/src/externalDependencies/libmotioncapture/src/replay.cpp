@@ -0,0 +1,413 @@
+#include "libmotioncapture/replay.h"
+#include "point_cloud_buffer.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace libmotioncapture {
+
+  namespace {
+    char const Magic[8] = {'M', 'C', 'R', 'E', 'P', 'L', 'A', 'Y'};
+    uint32_t const Version = 1;
+
+    template<typename T>
+    void read(FILE* file, T& value)
+    {
+      if (fread(&value, sizeof(T), 1, file) != 1) {
+        throw std::runtime_error("Truncated replay file");
+      }
+    }
+
+    template<typename T>
+    void write(FILE* file, const T& value)
+    {
+      if (fwrite(&value, sizeof(T), 1, file) != 1) {
+        throw std::runtime_error("Error writing replay file");
+      }
+    }
+
+    void writeBytes(FILE* file, const char* data, size_t size)
+    {
+      if (size > 0 && fwrite(data, size, 1, file) != 1) {
+        throw std::runtime_error("Error writing replay file");
+      }
+    }
+  }
+
+  SyntheticSwarmConfig::SyntheticSwarmConfig()
+    : vehicles(10)
+    , frameRate(100)
+    , duration(0)
+    , markers({
+        Eigen::Vector3f(0.0, 0.0, 0.02),
+        Eigen::Vector3f(0.03, 0.0, 0.0),
+        Eigen::Vector3f(0.0, 0.04, 0.0),
+        Eigen::Vector3f(-0.02, -0.01, 0.01)})
+    , spacing(0.5)
+    , radius(0.15)
+    , height(1.0)
+    , angularVelocity(1.0)
+    , markerNoise(0.0005)
+    , dropoutProbability(0.01)
+    , spuriousMarkers(0)
+    , seed(42)
+  {
+  }
+
+  class MotionCaptureReplayImpl
+  {
+  public:
+    struct RecordedFrame
+    {
+      std::chrono::microseconds time;
+      std::vector<Object> objects;
+      // x y z per marker
+      std::vector<float> markers;
+    };
+
+    void load(const std::string& filename)
+    {
+      FILE* file = fopen(filename.c_str(), "rb");
+      if (!file) {
+        throw std::runtime_error("Cannot open " + filename);
+      }
+      try {
+        char magic[8];
+        uint32_t version, reserved;
+        if (fread(magic, sizeof(magic), 1, file) != 1
+            || memcmp(magic, Magic, sizeof(magic)) != 0) {
+          throw std::runtime_error("Not a replay file: " + filename);
+        }
+        read(file, version);
+        read(file, reserved);
+        if (version != Version) {
+          std::stringstream sstr;
+          sstr << "Unsupported replay file version " << version;
+          throw std::runtime_error(sstr.str());
+        }
+
+        uint64_t micros;
+        while (fread(&micros, sizeof(micros), 1, file) == 1) {
+          frames.emplace_back();
+          RecordedFrame& frame = frames.back();
+          frame.time = std::chrono::microseconds(micros);
+          uint32_t objectCount, markerCount;
+          read(file, objectCount);
+          read(file, markerCount);
+          for (uint32_t i = 0; i < objectCount; ++i) {
+            uint32_t length, occluded;
+            read(file, length);
+            std::string name(length, '\0');
+            if (length > 0 && fread(&name[0], length, 1, file) != 1) {
+              throw std::runtime_error("Truncated replay file");
+            }
+            read(file, occluded);
+            float pose[7];
+            read(file, pose);
+            if (occluded) {
+              frame.objects.push_back(Object(name));
+            } else {
+              Eigen::Quaternionf rotation(pose[3], pose[4], pose[5], pose[6]);
+              frame.objects.push_back(Object(name, Eigen::Vector3f(pose[0], pose[1], pose[2]), rotation));
+            }
+          }
+          frame.markers.resize(3 * markerCount);
+          if (markerCount > 0
+              && fread(frame.markers.data(), 3 * sizeof(float), markerCount, file) != markerCount) {
+            throw std::runtime_error("Truncated replay file");
+          }
+        }
+      } catch (...) {
+        fclose(file);
+        throw;
+      }
+      fclose(file);
+
+      if (frames.empty()) {
+        throw std::runtime_error("Empty replay file: " + filename);
+      }
+    }
+
+    // fills objects and markers with frame number frameNumber
+    void generate()
+    {
+      const SyntheticSwarmConfig& c = config;
+      float const t = frameNumber / c.frameRate;
+      size_t const columns = std::max<size_t>(1, std::ceil(std::sqrt((double)c.vehicles)));
+      std::normal_distribution<float> noise(0, c.markerNoise);
+      std::uniform_real_distribution<float> uniform(0, 1);
+
+      objects.resize(c.vehicles);
+      markers.clear();
+      for (size_t i = 0; i < c.vehicles; ++i) {
+        Eigen::Vector3f center(c.spacing * (i % columns), c.spacing * (i / columns), c.height);
+        float angle = 0.7f * i + c.angularVelocity * t;
+        Eigen::Vector3f position = center + c.radius * Eigen::Vector3f(cos(angle), sin(angle), 0);
+        // heading along the circle
+        Eigen::Quaternionf rotation(Eigen::AngleAxisf(angle + M_PI / 2, Eigen::Vector3f::UnitZ()));
+
+        size_t visible = 0;
+        for (const auto& marker : c.markers) {
+          if (uniform(generator) < c.dropoutProbability) {
+            continue;
+          }
+          Eigen::Vector3f p = position + rotation * marker;
+          markers.push_back(p.x() + noise(generator));
+          markers.push_back(p.y() + noise(generator));
+          markers.push_back(p.z() + noise(generator));
+          ++visible;
+        }
+        // like a mocap system, which needs three markers for a pose
+        if (visible >= 3) {
+          objects[i] = Object(names[i], position, rotation);
+        } else {
+          objects[i] = Object(names[i]);
+        }
+      }
+
+      float const size = c.spacing * columns;
+      for (size_t i = 0; i < c.spuriousMarkers; ++i) {
+        markers.push_back(size * uniform(generator) - c.spacing / 2);
+        markers.push_back(size * uniform(generator) - c.spacing / 2);
+        markers.push_back(2 * c.height * uniform(generator));
+      }
+    }
+
+  public:
+    bool realtime;
+    bool loop;
+    std::chrono::steady_clock::time_point start;
+
+    // recorded stream
+    std::vector<RecordedFrame> frames;
+    size_t next;
+
+    // synthetic stream
+    bool synthetic;
+    SyntheticSwarmConfig config;
+    std::vector<std::string> names;
+    std::mt19937 generator;
+    uint64_t frameNumber;
+    std::vector<Object> objects;
+    std::vector<float> markers;
+
+    // current frame
+    std::chrono::microseconds time;
+    const std::vector<Object>* currentObjects;
+    const std::vector<float>* currentMarkers;
+  };
+
+  MotionCaptureReplay::MotionCaptureReplay(
+    const std::string& filename,
+    bool realtime,
+    bool loop)
+  {
+    pImpl = new MotionCaptureReplayImpl;
+    pImpl->realtime = realtime;
+    pImpl->loop = loop;
+    pImpl->next = 0;
+    pImpl->synthetic = false;
+    pImpl->frameNumber = 0;
+    pImpl->time = std::chrono::microseconds(0);
+    pImpl->currentObjects = &pImpl->objects;
+    pImpl->currentMarkers = &pImpl->markers;
+    try {
+      pImpl->load(filename);
+    } catch (...) {
+      delete pImpl;
+      throw;
+    }
+  }
+
+  MotionCaptureReplay::MotionCaptureReplay(
+    const SyntheticSwarmConfig& config,
+    bool realtime)
+  {
+    pImpl = new MotionCaptureReplayImpl;
+    pImpl->realtime = realtime;
+    pImpl->loop = false;
+    pImpl->next = 0;
+    pImpl->synthetic = true;
+    pImpl->config = config;
+    for (size_t i = 0; i < config.vehicles; ++i) {
+      pImpl->names.push_back("cf" + std::to_string(i + 1));
+    }
+    pImpl->generator.seed(config.seed);
+    pImpl->frameNumber = 0;
+    pImpl->time = std::chrono::microseconds(0);
+    pImpl->currentObjects = &pImpl->objects;
+    pImpl->currentMarkers = &pImpl->markers;
+  }
+
+  MotionCaptureReplay::~MotionCaptureReplay()
+  {
+    stopReceiveThread();
+    delete pImpl;
+  }
+
+  std::chrono::microseconds MotionCaptureReplay::frameTime() const
+  {
+    return pImpl->time;
+  }
+
+  void MotionCaptureReplay::waitForNextFrame()
+  {
+    MotionCaptureReplayImpl& r = *pImpl;
+    std::chrono::microseconds time;
+    if (r.synthetic) {
+      time = std::chrono::microseconds((int64_t)(1e6 * r.frameNumber / r.config.frameRate));
+      if (r.config.duration > 0 && time.count() >= 1e6 * r.config.duration) {
+        throw EndOfStream("End of replay");
+      }
+    } else {
+      if (r.next == r.frames.size()) {
+        if (!r.loop) {
+          throw EndOfStream("End of replay");
+        }
+        // continue one mean frame period after the last frame
+        std::chrono::microseconds length = r.frames.back().time - r.frames.front().time;
+        std::chrono::microseconds period(r.frames.size() > 1 ? length.count() / (r.frames.size() - 1) : 0);
+        r.start += length + period;
+        r.next = 0;
+      }
+      time = r.frames[r.next].time - r.frames.front().time;
+    }
+
+    if (r.frameNumber == 0) {
+      r.start = std::chrono::steady_clock::now();
+    } else if (r.realtime) {
+      std::this_thread::sleep_until(r.start + time);
+    }
+
+    if (r.synthetic) {
+      r.generate();
+    } else {
+      const MotionCaptureReplayImpl::RecordedFrame& frame = r.frames[r.next++];
+      r.currentObjects = &frame.objects;
+      r.currentMarkers = &frame.markers;
+    }
+    r.time = time;
+    ++r.frameNumber;
+    // the stream time is the device clock; restarts with every loop
+    clockOffsetEstimator().update(1e-6 * time.count(), std::chrono::steady_clock::now());
+    setCaptureTime(clockOffset().toHost(1e-6 * time.count()));
+    invalidateObjectTable();
+  }
+
+  void MotionCaptureReplay::getObjects(
+    std::vector<Object>& result) const
+  {
+    result = *pImpl->currentObjects;
+    stampCaptureTime(result);
+  }
+
+  void MotionCaptureReplay::getPointCloud(
+    pcl::PointCloud<pcl::PointXYZ>::Ptr result) const
+  {
+    const std::vector<float>& markers = *pImpl->currentMarkers;
+    size_t count = markers.size() / 3;
+    PointCloudCoordinates points = resizePointCloud(*result, count);
+    if (count > 0) {
+      points = PackedCoordinates(markers.data(), 3, count);
+    }
+    stampCaptureTime(*result);
+  }
+
+  void MotionCaptureReplay::getLatency(
+    std::vector<LatencyInfo>& result) const
+  {
+    result.clear();
+  }
+
+  bool MotionCaptureReplay::supportsObjectTracking() const
+  {
+    return true;
+  }
+
+  bool MotionCaptureReplay::supportsLatencyEstimate() const
+  {
+    return false;
+  }
+
+  bool MotionCaptureReplay::supportsPointCloud() const
+  {
+    return true;
+  }
+
+  MotionCaptureRecorder::MotionCaptureRecorder(
+    const std::string& filename)
+    : m_file(fopen(filename.c_str(), "wb"))
+    , m_start()
+    , m_objects()
+    , m_pointCloud(new pcl::PointCloud<pcl::PointXYZ>)
+  {
+    if (!m_file) {
+      throw std::runtime_error("Cannot open " + filename);
+    }
+    try {
+      writeBytes(m_file, Magic, sizeof(Magic));
+      write(m_file, Version);
+      write(m_file, (uint32_t)0);
+    } catch (...) {
+      fclose(m_file);
+      throw;
+    }
+  }
+
+  MotionCaptureRecorder::~MotionCaptureRecorder()
+  {
+    fclose(m_file);
+  }
+
+  void MotionCaptureRecorder::record(const MotionCapture& mocap)
+  {
+    auto now = std::chrono::steady_clock::now();
+    if (m_start == std::chrono::steady_clock::time_point()) {
+      m_start = now;
+    }
+    record(mocap, std::chrono::duration_cast<std::chrono::microseconds>(now - m_start));
+  }
+
+  void MotionCaptureRecorder::record(
+    const MotionCapture& mocap,
+    std::chrono::microseconds time)
+  {
+    m_objects.clear();
+    if (mocap.supportsObjectTracking()) {
+      mocap.getObjects(m_objects);
+    }
+    m_pointCloud->clear();
+    if (mocap.supportsPointCloud()) {
+      mocap.getPointCloud(m_pointCloud);
+    }
+
+    write(m_file, (uint64_t)time.count());
+    write(m_file, (uint32_t)m_objects.size());
+    write(m_file, (uint32_t)m_pointCloud->size());
+    for (const auto& object : m_objects) {
+      write(m_file, (uint32_t)object.name().size());
+      writeBytes(m_file, object.name().data(), object.name().size());
+      write(m_file, (uint32_t)object.occluded());
+      float pose[7] = {0, 0, 0, 1, 0, 0, 0};
+      if (!object.occluded()) {
+        pose[0] = object.position().x();
+        pose[1] = object.position().y();
+        pose[2] = object.position().z();
+        pose[3] = object.rotation().w();
+        pose[4] = object.rotation().x();
+        pose[5] = object.rotation().y();
+        pose[6] = object.rotation().z();
+      }
+      write(m_file, pose);
+    }
+    for (const auto& point : *m_pointCloud) {
+      float xyz[3] = {point.x, point.y, point.z};
+      write(m_file, xyz);
+    }
+  }
+
+}
@@ -1,4 +1,7 @@
 #include "libmotioncapture/vicon.h"
+#include "point_cloud_buffer.h"
+
+#include <thread>
 
 // VICON
 #include "ViconDataStreamSDK_CPP/DataStreamClient.h"
@@ -9,9 +12,61 @@ namespace libmotioncapture {
 
   class MotionCaptureViconImpl
   {
+  public:
+    bool getPose(
+      const std::string& name,
+      Eigen::Vector3f& position,
+      Eigen::Quaternionf& rotation)
+    {
+      auto const translation = client.GetSegmentGlobalTranslation(name, name);
+      auto const quaternion = client.GetSegmentGlobalRotationQuaternion(name, name);
+      if (   translation.Result != Result::Success
+          || quaternion.Result != Result::Success
+          || translation.Occluded
+          || quaternion.Occluded) {
+        return false;
+      }
+
+      position = Eigen::Vector3f(
+        translation.Translation[0] / 1000.0,
+        translation.Translation[1] / 1000.0,
+        translation.Translation[2] / 1000.0);
+
+      rotation = Eigen::Quaternionf(
+        quaternion.Rotation[3], // w
+        quaternion.Rotation[0], // x
+        quaternion.Rotation[1], // y
+        quaternion.Rotation[2]  // z
+        );
+      return true;
+    }
+
+    // The SDK reports the latency from the cameras to the client. The frame
+    // number is the device clock, which smoothes out the jitter of that.
+    void updateCaptureTime(ClockOffsetEstimator& clockOffset)
+    {
+      auto const receiveTime = std::chrono::steady_clock::now();
+      Output_GetLatencyTotal latency = client.GetLatencyTotal();
+      Output_GetFrameNumber frameNumber = client.GetFrameNumber();
+      Output_GetFrameRate frameRate = client.GetFrameRate();
+      captureTime = receiveTime;
+      if (latency.Result == Result::Success) {
+        captureTime -= std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(latency.Total));
+      }
+      if (   frameNumber.Result == Result::Success
+          && frameRate.Result == Result::Success
+          && frameRate.FrameRateHz > 0) {
+        double deviceTime = frameNumber.FrameNumber / frameRate.FrameRateHz;
+        clockOffset.update(deviceTime, captureTime);
+        captureTime = clockOffset.toHost(deviceTime);
+      }
+    }
+
   public:
     Client client;
     std::string version;
+    std::chrono::steady_clock::time_point captureTime;
   };
 
   MotionCaptureVicon::MotionCaptureVicon(
@@ -50,6 +105,7 @@ namespace libmotioncapture {
 
   MotionCaptureVicon::~MotionCaptureVicon()
   {
+    stopReceiveThread();
     delete pImpl;
   }
 
@@ -60,7 +116,26 @@ namespace libmotioncapture {
 
   void MotionCaptureVicon::waitForNextFrame()
   {
-    while (pImpl->client.GetFrame().Result != Result::Success) {
+    // In server push mode GetFrame() blocks on the SDK's receive thread for
+    // up to one second, so the timeout is checked at that granularity. It
+    // returns immediately while disconnected, which used to spin.
+    auto const start = std::chrono::steady_clock::now();
+    auto const timeout = waitTimeout();
+    for (;;) {
+      Result::Enum result = pImpl->client.GetFrame().Result;
+      if (result == Result::Success) {
+        pImpl->updateCaptureTime(clockOffsetEstimator());
+        setCaptureTime(pImpl->captureTime);
+        invalidateObjectTable();
+        return;
+      }
+      if (timeout.count() > 0
+          && std::chrono::steady_clock::now() - start >= timeout) {
+        throw FrameTimeout("Timeout waiting for Vicon frame");
+      }
+      if (result == Result::NotConnected) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
     }
   }
 
@@ -80,44 +155,44 @@ namespace libmotioncapture {
     const std::string& name,
     Object& result) const
   {
-    auto const translation = pImpl->client.GetSegmentGlobalTranslation(name, name);
-    auto const quaternion = pImpl->client.GetSegmentGlobalRotationQuaternion(name, name);
-    if (   translation.Result == Result::Success
-        && quaternion.Result == Result::Success
-        && !translation.Occluded
-        && !quaternion.Occluded) {
-
-      Eigen::Vector3f position(
-        translation.Translation[0] / 1000.0,
-        translation.Translation[1] / 1000.0,
-        translation.Translation[2] / 1000.0);
-
-      Eigen::Quaternionf rotation(
-        quaternion.Rotation[3], // w
-        quaternion.Rotation[0], // x
-        quaternion.Rotation[1], // y
-        quaternion.Rotation[2]  // z
-        );
-
+    Eigen::Vector3f position;
+    Eigen::Quaternionf rotation;
+    if (pImpl->getPose(name, position, rotation)) {
       result = Object(name, position, rotation);
     } else {
       result = Object(name);
     }
+    stampCaptureTime(result);
+  }
+
+  void MotionCaptureVicon::updateObjectTable() const
+  {
+    // only the subjects somebody asked for; the SDK is keyed by name
+    Eigen::Vector3f position;
+    Eigen::Quaternionf rotation;
+    for (ObjectHandle handle = 0; handle < objectHandleCount(); ++handle) {
+      if (pImpl->getPose(objectName(handle), position, rotation)) {
+        setObjectPose(handle, position, rotation);
+      }
+    }
   }
 
   void MotionCaptureVicon::getPointCloud(
     pcl::PointCloud<pcl::PointXYZ>::Ptr result) const
   {
-    result->clear();
     size_t count = pImpl->client.GetUnlabeledMarkerCount().MarkerCount;
+    PointCloudCoordinates points = resizePointCloud(*result, count);
     for(size_t i = 0; i < count; ++i) {
       Output_GetUnlabeledMarkerGlobalTranslation translation =
         pImpl->client.GetUnlabeledMarkerGlobalTranslation(i);
-      result->push_back(pcl::PointXYZ(
-        translation.Translation[0] / 1000.0,
-        translation.Translation[1] / 1000.0,
-        translation.Translation[2] / 1000.0));
+      points.col(i) <<
+        translation.Translation[0],
+        translation.Translation[1],
+        translation.Translation[2];
     }
+    // mm to m
+    points *= 0.001f;
+    stampCaptureTime(*result);
   }
 
   void MotionCaptureVicon::getLatency(
@@ -130,6 +205,8 @@ namespace libmotioncapture {
       double      sampleValue = pImpl->client.GetLatencySampleValue(sampleName).Value;
       result.emplace_back(LatencyInfo(sampleName, sampleValue));
     }
+    std::string transport = "Transport";
+    result.emplace_back(LatencyInfo(transport, clockOffset().delay()));
   }
 
   bool MotionCaptureVicon::supportsObjectTracking() const
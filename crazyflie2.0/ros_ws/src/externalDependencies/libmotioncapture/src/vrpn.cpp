@@ -1,9 +1,9 @@
 #include "libmotioncapture/vrpn.h"
 
+#include <algorithm>
 #include <unordered_map>
 #include <unordered_set>
 #include <iostream>
-#include <thread>
 
 // VRPN
 #include <vrpn_Tracker.h>
@@ -24,6 +24,12 @@ namespace libmotioncapture {
     std::unordered_map<std::string, std::shared_ptr<vrpn_Tracker_Remote> > trackers;
     std::unordered_map<std::string, vrpn_TRACKERCB> trackerData;
 
+    // the server's wall clock, in seconds
+    static double deviceTime(const vrpn_TRACKERCB& data)
+    {
+      return data.msg_time.tv_sec + data.msg_time.tv_usec / 1e6;
+    }
+
     void updateTrackers()
     {
       const char* name = nullptr;
@@ -60,6 +66,7 @@ namespace libmotioncapture {
 
   MotionCaptureVrpn::~MotionCaptureVrpn()
   {
+    stopReceiveThread();
     delete pImpl;
   }
 
@@ -67,13 +74,43 @@ namespace libmotioncapture {
   {
     pImpl->updateTrackers();
     pImpl->trackerData.clear();
+    auto const timeout = waitTimeout();
+    auto const deadline = std::chrono::steady_clock::now() + timeout;
     do {
-      pImpl->connection->mainloop();
-      for (auto tracker : pImpl->trackers) {
+      // blocks in select() until data arrives; wake up regularly to check
+      // the timeout
+      std::chrono::microseconds wait(100000);
+      if (timeout.count() > 0) {
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+          deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) {
+          throw FrameTimeout("Timeout waiting for VRPN frame");
+        }
+        wait = std::min(wait, remaining);
+      }
+      timeval tv;
+      tv.tv_sec = wait.count() / 1000000;
+      tv.tv_usec = wait.count() % 1000000;
+      pImpl->connection->mainloop(&tv);
+      for (auto& tracker : pImpl->trackers) {
         tracker.second->mainloop();
       }
-      std::this_thread::sleep_for(std::chrono::microseconds(1));
     } while(pImpl->trackerData.size() < pImpl->trackers.size());
+
+    // every tracker has its own time stamp; the frame is as old as the
+    // newest one
+    auto const receiveTime = std::chrono::steady_clock::now();
+    double newest = 0;
+    for (const auto& data : pImpl->trackerData) {
+      newest = std::max(newest, MotionCaptureVrpnImpl::deviceTime(data.second));
+    }
+    if (!pImpl->trackerData.empty()) {
+      clockOffsetEstimator().update(newest, receiveTime);
+      setCaptureTime(clockOffset().toHost(newest));
+    } else {
+      setCaptureTime(receiveTime);
+    }
+    invalidateObjectTable();
   }
 
   void MotionCaptureVrpn::getObjects(
@@ -94,6 +131,8 @@ namespace libmotioncapture {
         );
 
       result.push_back(Object(data.first, position, rotation));
+      result.back().setCaptureTime(clockOffset().toHost(
+        MotionCaptureVrpnImpl::deviceTime(data.second)));
     }
   }
 
@@ -117,6 +156,8 @@ namespace libmotioncapture {
         );
 
       result = Object(name, position, rotation);
+      result.setCaptureTime(clockOffset().toHost(
+        MotionCaptureVrpnImpl::deviceTime(data->second)));
     }
   }
 
@@ -124,12 +165,15 @@ namespace libmotioncapture {
     pcl::PointCloud<pcl::PointXYZ>::Ptr result) const
   {
     result->clear();
+    stampCaptureTime(*result);
   }
 
   void MotionCaptureVrpn::getLatency(
     std::vector<LatencyInfo>& result) const
   {
     result.clear();
+    std::string transport = "Transport";
+    result.emplace_back(LatencyInfo(transport, clockOffset().delay()));
   }
 
   bool MotionCaptureVrpn::supportsObjectTracking() const
@@ -139,7 +183,7 @@ namespace libmotioncapture {
 
   bool MotionCaptureVrpn::supportsLatencyEstimate() const
   {
-    return false;
+    return true;
   }
 
   bool MotionCaptureVrpn::supportsPointCloud() const
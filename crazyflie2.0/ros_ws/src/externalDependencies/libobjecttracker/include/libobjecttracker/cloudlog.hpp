@@ -5,21 +5,48 @@
 #include "libobjecttracker/object_tracker.h"
 
 #include <chrono>
+#include <condition_variable>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <pcl/common/transforms.h>
 #include <pcl/registration/icp.h>
 #include <pcl/registration/transformation_estimation_2D.h>
 
-// point cloud log format:
+// point cloud log format, version 2 (native byte order):
+// file header : magic "CFCLOUD\0" (8 bytes), version : uint32, reserved : uint32
+// chunks      : chunk magic : uint32, frame count : uint32, frame bytes : uint64,
+//               followed by that many frames:
+//                 timestamp (microseconds) : uint64
+//                 cloud size               : uint32
+//                 reserved                 : uint32
+//                 [x y z, x y z, ... ]     : float32
+// frame index : per frame: file offset of the frame : uint64,
+//               timestamp : uint64, cloud size : uint32, reserved : uint32
+// trailer     : index offset : uint64, frame count : uint64, magic "CFINDEX\0"
+//
+// Index and trailer are written when the logger is closed. Files without
+// them (e.g. after a crash) are indexed by walking the chunks instead.
+//
+// version 1 (no file header) is still played back:
 // infinite repetitions of:
 // timestamp (milliseconds) : uint32
 // cloud size               : uint32
 // [x y z, x y z, ... ]     : float32
 
-#define markermax 60*4 
+#define markermax 60*4
 
 using Point = pcl::PointXYZ;
 using Cloud = pcl::PointCloud<Point>;
@@ -27,96 +54,449 @@ using ICP = pcl::IterativeClosestPoint<Point, Point>;
 
 namespace libobjecttracker {
 
+	namespace cloudlog {
+		static char const FileMagic[8] = {'C', 'F', 'C', 'L', 'O', 'U', 'D', '\0'};
+		static char const IndexMagic[8] = {'C', 'F', 'I', 'N', 'D', 'E', 'X', '\0'};
+		static uint32_t const ChunkMagic = 0x4b4e4843; // "CHNK"
+		static uint32_t const Version = 2;
+
+		struct FileHeader
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t reserved;
+		};
+
+		struct ChunkHeader
+		{
+			uint32_t magic;
+			uint32_t frames;
+			uint64_t bytes;
+		};
+
+		struct FrameHeader
+		{
+			uint64_t micros;
+			uint32_t size;
+			uint32_t reserved;
+		};
+
+		struct IndexEntry
+		{
+			uint64_t offset;
+			uint64_t micros;
+			uint32_t size;
+			uint32_t reserved;
+		};
+
+		struct Trailer
+		{
+			uint64_t indexOffset;
+			uint64_t frames;
+			char magic[8];
+		};
+
+		static_assert(sizeof(FileHeader) == 16, "unexpected padding");
+		static_assert(sizeof(ChunkHeader) == 16, "unexpected padding");
+		static_assert(sizeof(FrameHeader) == 16, "unexpected padding");
+		static_assert(sizeof(IndexEntry) == 24, "unexpected padding");
+		static_assert(sizeof(Trailer) == 24, "unexpected padding");
+	} // namespace cloudlog
+
+	// Records point clouds without blocking the caller: log() only copies
+	// the points into a buffer, and a background thread writes the buffered
+	// frames as one chunk. The buffers keep their capacity, so logging does
+	// not allocate once they have grown to the typical backlog.
 	class PointCloudLogger
 	{
 	public:
-		PointCloudLogger(std::string file_path) : file(file_path, std::ios::binary | std::ios::out)
+		PointCloudLogger(std::string file_path)
+			: file(file_path, std::ios::binary | std::ios::out)
+			, started(false)
+			, offset(0)
+			, pendingFrames(0)
+			, flushRequested(false)
+			, stop(false)
+		{
+			if (!file) {
+				throw std::runtime_error("PointCloudLogger: bad file path.");
+			}
+			cloudlog::FileHeader header;
+			memcpy(header.magic, cloudlog::FileMagic, sizeof(header.magic));
+			header.version = cloudlog::Version;
+			header.reserved = 0;
+			write(header);
+			writer = std::thread(&PointCloudLogger::run, this);
+		}
+
+		PointCloudLogger(const PointCloudLogger&) = delete;
+		PointCloudLogger& operator=(const PointCloudLogger&) = delete;
+
+		~PointCloudLogger()
 		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				stop = true;
+			}
+			cvWork.notify_one();
+			writer.join();
+
+			cloudlog::Trailer trailer;
+			trailer.indexOffset = offset;
+			trailer.frames = index.size();
+			memcpy(trailer.magic, cloudlog::IndexMagic, sizeof(trailer.magic));
+			file.write((char const *)index.data(), index.size() * sizeof(cloudlog::IndexEntry));
+			write(trailer);
 		}
 
 		void log(pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud)
 		{
-			auto stamp = std::chrono::high_resolution_clock::now();
-			if (start == (decltype(start)())) {
-				start = stamp;
+			log(std::chrono::high_resolution_clock::now(), cloud);
+		}
+
+		void log(std::chrono::high_resolution_clock::time_point stamp,
+			pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				float* xyz = beginFrame(stamp, cloud->size());
+				for (pcl::PointXYZ const &p : *cloud) {
+					static_assert(std::is_same<decltype(p.x), float>::value, "expected float");
+					*xyz++ = p.x;
+					*xyz++ = p.y;
+					*xyz++ = p.z;
+				}
 			}
-			auto millis = std::chrono::duration_cast<std::chrono::milliseconds>
-				(stamp - start).count();
+			cvWork.notify_one();
+		}
 
-			write<uint32_t>(file, millis);
-			write<uint32_t>(file, cloud->size());
-			for (pcl::PointXYZ const &p : *cloud) {
-				static_assert(std::is_same<decltype(p.x), float>::value, "expected float");
-				write(file, p.x);
-				write(file, p.y);
-				write(file, p.z);
+		// xyz holds numPoints packed (x, y, z) triples
+		void log(std::chrono::high_resolution_clock::time_point stamp,
+			const float* xyz, size_t numPoints)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				memcpy(beginFrame(stamp, numPoints), xyz, 3 * numPoints * sizeof(float));
 			}
+			cvWork.notify_one();
 		}
 
+		// blocks until everything logged so far is on disk
 		void flush()
 		{
-			file.flush();
+			std::unique_lock<std::mutex> lock(mutex);
+			flushRequested = true;
+			cvWork.notify_one();
+			cvDone.wait(lock, [this] { return !flushRequested; });
 		}
 
 	protected:
+		// requires the lock; returns where the frame's points go
+		float* beginFrame(std::chrono::high_resolution_clock::time_point stamp, size_t numPoints)
+		{
+			if (!started) {
+				start = stamp;
+				started = true;
+			}
+			cloudlog::FrameHeader header;
+			header.micros = std::chrono::duration_cast<std::chrono::microseconds>
+				(stamp - start).count();
+			header.size = numPoints;
+			header.reserved = 0;
+
+			size_t pos = pending.size();
+			pending.resize(pos + sizeof(header) + 3 * numPoints * sizeof(float));
+			memcpy(&pending[pos], &header, sizeof(header));
+			++pendingFrames;
+			return (float *)&pending[pos + sizeof(header)];
+		}
+
+		void run()
+		{
+			std::vector<char> chunk;
+			while (true) {
+				uint32_t chunkFrames;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					cvWork.wait(lock, [this] {
+						return stop || flushRequested || !pending.empty();
+					});
+					if (stop && pending.empty()) {
+						return;
+					}
+					std::swap(chunk, pending);
+					chunkFrames = pendingFrames;
+					pendingFrames = 0;
+				}
+
+				if (!chunk.empty()) {
+					writeChunk(chunk, chunkFrames);
+					chunk.clear();
+				}
+
+				std::unique_lock<std::mutex> lock(mutex);
+				if (flushRequested && pending.empty()) {
+					file.flush();
+					flushRequested = false;
+					cvDone.notify_all();
+				}
+			}
+		}
+
+		void writeChunk(const std::vector<char>& chunk, uint32_t frames)
+		{
+			cloudlog::ChunkHeader header;
+			header.magic = cloudlog::ChunkMagic;
+			header.frames = frames;
+			header.bytes = chunk.size();
+			write(header);
+
+			for (size_t pos = 0; pos < chunk.size(); ) {
+				cloudlog::FrameHeader frame;
+				memcpy(&frame, &chunk[pos], sizeof(frame));
+				cloudlog::IndexEntry entry;
+				entry.offset = offset + pos;
+				entry.micros = frame.micros;
+				entry.size = frame.size;
+				entry.reserved = 0;
+				index.push_back(entry);
+				pos += sizeof(frame) + 3 * frame.size * sizeof(float);
+			}
+
+			file.write(chunk.data(), chunk.size());
+			offset += chunk.size();
+		}
+
 		template <typename T>
-		void write(std::ofstream &s, T const &t)
+		void write(T const &t)
 		{
-			s.write((char const *)&t, sizeof(T));
+			file.write((char const *)&t, sizeof(T));
+			offset += sizeof(T);
 		}
+
 		std::ofstream file;
 		std::chrono::high_resolution_clock::time_point start;
+		bool started;
+		// owned by the writer thread
+		uint64_t offset;
+		std::vector<cloudlog::IndexEntry> index;
+
+		std::thread writer;
+		std::mutex mutex;
+		std::condition_variable cvWork;
+		std::condition_variable cvDone;
+		std::vector<char> pending;
+		uint32_t pendingFrames;
+		bool flushRequested;
+		bool stop;
 	};
 
+	// Plays back a point cloud log. The file is memory-mapped and only a
+	// frame index is kept in memory, so frames can be accessed in any order
+	// and long logs are paged in as they are played.
 	class PointCloudPlayer
 	{
 	public:
+		PointCloudPlayer()
+			: data(nullptr)
+			, dataSize(0)
+		{
+		}
+
+		PointCloudPlayer(const PointCloudPlayer&) = delete;
+		PointCloudPlayer& operator=(const PointCloudPlayer&) = delete;
+
+		~PointCloudPlayer()
+		{
+			unmap();
+		}
+
 		void load(std::string path)
 		{
-			std::ifstream s(path, std::ios::binary | std::ios::in);
-			if (!s) {
+			unmap();
+			frames.clear();
+
+			int fd = open(path.c_str(), O_RDONLY);
+			if (fd < 0) {
 				throw std::runtime_error("PointCloudPlayer: bad file path.");
 			}
-			while (s) {
-				uint32_t millis = read<uint32_t>(s);
-				// TODO cleaner loop?
-				if (!s) {
-					break;
+			struct stat st;
+			if (fstat(fd, &st) != 0) {
+				close(fd);
+				throw std::runtime_error("PointCloudPlayer: cannot stat file.");
+			}
+			dataSize = st.st_size;
+			if (dataSize > 0) {
+				void* p = mmap(nullptr, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p == MAP_FAILED) {
+					close(fd);
+					dataSize = 0;
+					throw std::runtime_error("PointCloudPlayer: cannot map file.");
 				}
-				timestamps.push_back(millis);
-
-				uint32_t size = read<uint32_t>(s);
-				clouds.emplace_back(new pcl::PointCloud<pcl::PointXYZ>());
-				clouds.back()->resize(size);
-				for (uint32_t i = 0; i < size; ++i) {
-					float x = read<float>(s);
-					float y = read<float>(s);
-					float z = read<float>(s);
-					(*clouds.back())[i] = pcl::PointXYZ(x, y, z);
+				data = (char const *)p;
+				madvise(p, dataSize, MADV_SEQUENTIAL);
+			}
+			close(fd);
+
+			cloudlog::FileHeader header;
+			if (dataSize >= sizeof(header)
+				&& memcmp(data, cloudlog::FileMagic, sizeof(header.magic)) == 0) {
+				memcpy(&header, data, sizeof(header));
+				if (header.version != cloudlog::Version) {
+					throw std::runtime_error("PointCloudPlayer: unsupported log version.");
 				}
+				if (!readIndex()) {
+					scanChunks();
+				}
+			}
+			else {
+				scanVersion1();
 			}
 		}
 
 		void play(libobjecttracker::ObjectTracker &tracker) const
 		{
-			for (size_t i = 0; i < clouds.size(); ++i) {
+			for (size_t i = 0; i < frames.size(); ++i) {
 				printf("\n  %d  ------------------------------\n", i);
-				auto dur = std::chrono::milliseconds(timestamps[i]);
-				std::chrono::high_resolution_clock::time_point stamp(dur);
-				tracker.update(stamp, clouds[i]);
+				tracker.update(stamp(i), points(i), numPoints(i));
+			}
+		}
+
+		size_t size() const
+		{
+			return frames.size();
+		}
+
+		std::chrono::high_resolution_clock::time_point stamp(size_t i) const
+		{
+			return std::chrono::high_resolution_clock::time_point(
+				std::chrono::microseconds(frames[i].micros));
+		}
+
+		// packed (x, y, z) triples, valid while the player is loaded
+		const float* points(size_t i) const
+		{
+			return (const float *)(data + frames[i].offset);
+		}
+
+		size_t numPoints(size_t i) const
+		{
+			return frames[i].size;
+		}
+
+		// copies the frame into a new cloud
+		pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(size_t i) const
+		{
+			pcl::PointCloud<pcl::PointXYZ>::Ptr result(new pcl::PointCloud<pcl::PointXYZ>());
+			result->resize(numPoints(i));
+			const float* xyz = points(i);
+			for (size_t j = 0; j < numPoints(i); ++j) {
+				(*result)[j] = pcl::PointXYZ(xyz[3 * j], xyz[3 * j + 1], xyz[3 * j + 2]);
 			}
+			return result;
 		}
 
 	protected:
+		struct Frame
+		{
+			// of the first float
+			uint64_t offset;
+			uint64_t micros;
+			uint32_t size;
+		};
+
 		template <typename T>
-		T read(std::ifstream &s)
+		bool read(uint64_t pos, T& t) const
+		{
+			if (pos + sizeof(T) > dataSize) {
+				return false;
+			}
+			memcpy(&t, data + pos, sizeof(T));
+			return true;
+		}
+
+		bool addFrame(uint64_t pos, uint64_t micros, uint32_t size)
 		{
-			T t;
-			s.read((char *)&t, sizeof(t));
-			return t;
+			if (pos + 3 * (uint64_t)size * sizeof(float) > dataSize) {
+				return false;
+			}
+			Frame frame;
+			frame.offset = pos;
+			frame.micros = micros;
+			frame.size = size;
+			frames.push_back(frame);
+			return true;
+		}
+
+		bool readIndex()
+		{
+			cloudlog::Trailer trailer;
+			if (dataSize < sizeof(cloudlog::FileHeader) + sizeof(trailer)
+				|| !read(dataSize - sizeof(trailer), trailer)
+				|| memcmp(trailer.magic, cloudlog::IndexMagic, sizeof(trailer.magic)) != 0
+				|| trailer.indexOffset + trailer.frames * sizeof(cloudlog::IndexEntry)
+					!= dataSize - sizeof(trailer)) {
+				return false;
+			}
+			frames.reserve(trailer.frames);
+			for (uint64_t i = 0; i < trailer.frames; ++i) {
+				cloudlog::IndexEntry entry;
+				read(trailer.indexOffset + i * sizeof(entry), entry);
+				if (!addFrame(entry.offset + sizeof(cloudlog::FrameHeader), entry.micros, entry.size)) {
+					frames.clear();
+					return false;
+				}
+			}
+			return true;
+		}
+
+		void scanChunks()
+		{
+			uint64_t pos = sizeof(cloudlog::FileHeader);
+			cloudlog::ChunkHeader chunk;
+			while (read(pos, chunk) && chunk.magic == cloudlog::ChunkMagic) {
+				uint64_t end = pos + sizeof(chunk) + chunk.bytes;
+				if (end > dataSize) {
+					// truncated chunk
+					break;
+				}
+				pos += sizeof(chunk);
+				cloudlog::FrameHeader frame;
+				while (pos < end && read(pos, frame)) {
+					pos += sizeof(frame);
+					addFrame(pos, frame.micros, frame.size);
+					pos += 3 * (uint64_t)frame.size * sizeof(float);
+				}
+				pos = end;
+			}
+		}
+
+		void scanVersion1()
+		{
+			uint64_t pos = 0;
+			uint32_t millis;
+			uint32_t size;
+			while (read(pos, millis) && read(pos + sizeof(millis), size)) {
+				pos += sizeof(millis) + sizeof(size);
+				if (!addFrame(pos, 1000 * (uint64_t)millis, size)) {
+					break;
+				}
+				pos += 3 * (uint64_t)size * sizeof(float);
+			}
 		}
-		std::vector<uint32_t> timestamps;
-		std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr> clouds;
+
+		void unmap()
+		{
+			if (data) {
+				munmap((void *)data, dataSize);
+				data = nullptr;
+				dataSize = 0;
+			}
+		}
+
+		char const *data;
+		uint64_t dataSize;
+		std::vector<Frame> frames;
 	};
 
 	class PointCloudDebugger : public PointCloudPlayer
@@ -135,11 +515,9 @@ namespace libobjecttracker {
 			};
 
 			//play points
-			for (size_t i = 0; i < clouds.size(); ++i) {
+			for (size_t i = 0; i < size(); ++i) {
 				printf("\n  %d  ------------------------------\n", i);
-				auto dur = std::chrono::milliseconds(timestamps[i]);
-				std::chrono::high_resolution_clock::time_point stamp(dur);
-				tracker.update(stamp, clouds[i]);
+				tracker.update(stamp(i), points(i), numPoints(i));
 				//continue;
 				//make another output cloud
 				matches.emplace_back(new pcl::PointCloud<pcl::PointXYZ>());
@@ -161,25 +539,13 @@ namespace libobjecttracker {
 				}
 			}
 			printf("Writing converted file\n");
-			std::ofstream s(writepath, std::ios::binary | std::ios::out);
+			PointCloudLogger logger(writepath);
 			for (size_t i = 0; i < matches.size(); ++i) {
-				write(s, timestamps[i]);
-				write(s, (uint32_t)matches[i]->size());
-				for (pcl::PointXYZ const &p : *(matches[i])) {
-					static_assert(std::is_same<decltype(p.x), float>::value, "expected float");
-					write(s, p.x);
-					write(s, p.y);
-					write(s, p.z);
-				}
+				logger.log(stamp(i), matches[i]);
 			}
 		}
 
 	private:
-		template <typename T>
-		void write(std::ofstream &s, T const &t)
-		{
-			s.write((char const *)&t, sizeof(T));
-		}
 		std::string writepath;
 		std::string path;
 		std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr> matches;
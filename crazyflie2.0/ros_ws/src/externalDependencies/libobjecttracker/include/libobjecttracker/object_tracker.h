@@ -2,6 +2,10 @@
 #include <cstddef>
 #include <stdint.h>
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -21,8 +25,99 @@ namespace libobjecttracker {
     double maxFitnessScore;
   };
 
+  // algorithm used to register each object's markers frame-by-frame
+  enum RegistrationBackend
+  {
+    // generic pcl::IterativeClosestPoint
+    RegistrationBackendPclICP,
+    // nearest-neighbor gating plus closed-form SVD (small marker sets only)
+    RegistrationBackendClosedForm,
+  };
+
+  // how the pose is predicted before each frame's alignment
+  enum MotionModel
+  {
+    // start from the last valid pose
+    MotionModelNone,
+    // extrapolate the last pose with its linear and angular velocity
+    MotionModelConstantVelocity,
+    // as above, but position and velocity come from a per-object Kalman filter
+    MotionModelKalman,
+  };
+
+  // per-object track lifecycle
+  enum TrackingState
+  {
+    // not found yet; searched for near the nominal position
+    TrackingStateInitializing,
+    // valid pose in the latest frame
+    TrackingStateTracked,
+    // briefly without a valid pose; still registered from the prediction
+    TrackingStateCoasting,
+    // coasted for too long; searched for near the last pose every frame
+    TrackingStateLost,
+    // found again, but not reported until it was registered a few times
+    TrackingStateReacquiring,
+  };
+
+  // checks applied to every registration; bits of ObjectDiagnostics::failedChecks
+  enum TrackingCheck
+  {
+    TrackingCheckConverged,
+    TrackingCheckXVelocity,
+    TrackingCheckYVelocity,
+    TrackingCheckZVelocity,
+    TrackingCheckRollRate,
+    TrackingCheckPitchRate,
+    TrackingCheckYawRate,
+    TrackingCheckRoll,
+    TrackingCheckPitch,
+    TrackingCheckFitness,
+    TrackingCheckCount,
+  };
+
+  // outcome of one object's registration in one frame
+  struct ObjectDiagnostics
+  {
+    uint64_t frame;
+    std::chrono::high_resolution_clock::time_point stamp;
+    uint32_t objectIdx;
+    // state after this frame
+    TrackingState state;
+    // (1 << TrackingCheck) for every check that failed
+    uint32_t failedChecks;
+    // the object went from coasting or reacquiring to lost
+    bool lostTrack;
+    float dt;
+    float fitness;
+    float velocity[3];
+    // roll, pitch and yaw rate
+    float rates[3];
+    float roll;
+    float pitch;
+  };
+
+  // totals since the tracker was created
+  struct TrackerCounters
+  {
+    uint64_t frames;
+    uint64_t registrations;
+    // registrations that failed at least one check
+    uint64_t rejected;
+    uint64_t failedChecks[TrackingCheckCount];
+    uint64_t lostTracks;
+    uint64_t initializationFailures;
+    // diagnostics that did not fit into the buffer
+    uint64_t droppedDiagnostics;
+  };
+
   class ObjectTracker;
   class PointCloudDebugger;
+  class ThreadPool;
+  template <typename T> class RingBuffer;
+  struct AtomicTrackerCounters;
+  class MarkerIndex;
+  struct ObjectTrackingContext;
   class Object
   {
   public:
@@ -39,6 +134,16 @@ namespace libobjecttracker {
 
     bool lastTransformationValid() const;
 
+    TrackingState state() const { return m_state; }
+
+    // false until the object was found in the point cloud
+    bool initialized() const { return m_state != TrackingStateInitializing; }
+
+    // world frame, m/s and rad/s; only meaningful while velocityValid()
+    const Eigen::Vector3f& velocity() const { return m_velocity; }
+    const Eigen::Vector3f& angularVelocity() const { return m_angularVelocity; }
+    bool velocityValid() const { return m_velocityValid; }
+
     std::chrono::time_point<std::chrono::high_resolution_clock> lastValidTime() const {
       return m_lastValidTransform;
     }
@@ -49,8 +154,14 @@ namespace libobjecttracker {
     Eigen::Affine3f m_lastTransformation;
     const Eigen::Affine3f m_initialTransformation;
     Eigen::Vector3f m_velocity;
+    Eigen::Vector3f m_angularVelocity;
+    // set once two consecutive frames were tracked
+    bool m_velocityValid;
     std::chrono::time_point<std::chrono::high_resolution_clock> m_lastValidTransform;
     bool m_lastTransformationValid;
+    TrackingState m_state;
+    // consecutive registrations while reacquiring
+    int m_reacquireCount;
 
     friend ObjectTracker;
     friend PointCloudDebugger;
@@ -66,6 +177,27 @@ namespace libobjecttracker {
       const std::vector<MarkerConfiguration>& markerConfigurations,
       const std::vector<Object>& objects);
 
+    ~ObjectTracker();
+
+    // objects are registered in parallel on this many threads
+    // (including the caller); 1 keeps everything on the calling thread
+    void setNumThreads(size_t numThreads);
+
+    // throws if a marker configuration is too large for the chosen backend
+    void setRegistrationBackend(RegistrationBackend backend);
+
+    void setMotionModel(MotionModel model);
+
+    // with a motion model, the correspondence search radius shrinks to
+    // minCorrespondenceDistance (m) plus how far an object accelerating at
+    // maxAcceleration (m/s^2) can deviate from the prediction
+    void setPredictionBounds(float maxAcceleration, float minCorrespondenceDistance);
+
+    // an object coasts for at most coastTimeout seconds before it is
+    // considered lost; once found again, it has to be registered in
+    // reacquireFrames consecutive frames before its pose is valid
+    void setTrackLossPolicy(double coastTimeout, int reacquireFrames);
+
     void update(
       pcl::PointCloud<pcl::PointXYZ>::Ptr pointCloud);
 
@@ -73,17 +205,58 @@ namespace libobjecttracker {
     void update(std::chrono::high_resolution_clock::time_point stamp,
       pcl::PointCloud<pcl::PointXYZ>::Ptr pointCloud);
 
+    // xyz holds numPoints packed (x, y, z) triples, e.g. the data() of an
+    // Eigen::Matrix3Xf. The markers are copied into a buffer owned by the
+    // tracker, which is reused, so nothing is allocated per frame.
+    void update(std::chrono::high_resolution_clock::time_point stamp,
+      const float* xyz, size_t numPoints);
+
     const std::vector<Object>& objects() const;
 
+    // only rare events (initialization failures, lost tracks) are reported
+    // as text; per-frame registration failures go to the diagnostics below
     void setLogWarningCallback(
       std::function<void(const std::string&)> logWarn);
 
+    // safe to call from any thread
+    TrackerCounters counters() const;
+
+    // keeps the diagnostics of rejected registrations (or of all, if
+    // recordAll) in a buffer of the given capacity, for another thread to
+    // consume with popDiagnostics(); 0 disables it. Call before tracking.
+    void setDiagnosticsBuffer(size_t capacity, bool recordAll);
+
+    // single consumer; returns false if the buffer is empty
+    bool popDiagnostics(ObjectDiagnostics& diagnostics);
+
+    // of the object's latest registration; valid until the next update
+    const ObjectDiagnostics& lastDiagnostics(size_t objectIdx) const;
+
+    // human-readable description, formatted on the caller's thread
+    std::string formatDiagnostics(const ObjectDiagnostics& diagnostics) const;
+
   private:
     void runICP(std::chrono::high_resolution_clock::time_point stamp,
       const pcl::PointCloud<pcl::PointXYZ>::ConstPtr markers);
 
-    bool initialize(
-      pcl::PointCloud<pcl::PointXYZ>::ConstPtr markers);
+    void trackObject(size_t objectIdx,
+      std::chrono::high_resolution_clock::time_point stamp);
+
+    Eigen::Affine3f predictTransformation(size_t objectIdx, float dt,
+      float& maxCorrespondenceDistance) const;
+
+    void trackingFailed(size_t objectIdx,
+      std::chrono::high_resolution_clock::time_point stamp);
+
+    void resetMotion(size_t objectIdx);
+
+    // searches for initializing and lost objects among the markers not taken
+    // by tracked objects; returns false if an initializing object was not found
+    bool acquire(const std::vector<size_t>& pending,
+      std::chrono::high_resolution_clock::time_point stamp);
+
+    // marks the markers explained by an object's current pose as taken
+    void takeObjectMarkers(size_t objectIdx);
 
     void logWarn(const std::string& msg);
 
@@ -91,8 +264,31 @@ namespace libobjecttracker {
     std::vector<MarkerConfiguration> m_markerConfigurations;
     std::vector<DynamicsConfiguration> m_dynamicsConfigurations;
     std::vector<Object> m_objects;
-    bool m_initialized;
     int m_init_attempts;
+    RegistrationBackend m_backend;
+    MotionModel m_motionModel;
+    float m_maxAcceleration;
+    float m_minCorrespondenceDistance;
+    // link distance used to cluster markers during initialization
+    float m_clusterRadius;
+    float m_maxInitDeviation;
+    double m_coastTimeout;
+    int m_reacquireFrames;
+
+    // one ICP context per object, so objects can be tracked concurrently
+    std::vector<std::unique_ptr<ObjectTrackingContext> > m_contexts;
+    std::unique_ptr<ThreadPool> m_threadPool;
+    // spatial index over the current frame's markers, built once per update
+    std::unique_ptr<MarkerIndex> m_markerIndex;
+    // markers passed in as a float array
+    pcl::PointCloud<pcl::PointXYZ>::Ptr m_frameBuffer;
+
+    uint64_t m_frame;
+    std::unique_ptr<AtomicTrackerCounters> m_counters;
+    // initialization failures are only logged when they start
+    bool m_initializationFailing;
+    std::unique_ptr<RingBuffer<ObjectDiagnostics> > m_diagnostics;
+    bool m_recordAllDiagnostics;
 
     std::function<void(const std::string&)> m_logWarn;
   };
@@ -0,0 +1,312 @@
+// Replays a recorded point cloud log through the object tracker as fast as
+// possible, once per tracker configuration, and reports per-frame latency,
+// registration convergence and dynamic-check failures. Poses can be saved
+// and compared against the other configurations or a saved earlier run,
+// e.g. from a previous version of the tracker.
+//
+// usage: benchmark_replay <cloud log> [options]
+//   --config <dir>     directory with hover_swarm.launch and crazyflies.yaml
+//   --run <b>:<m>      backend (icp, closedform) and motion model (none, cv,
+//                      kalman); repeatable, default: all useful combinations
+//   --threads <n>      tracker threads (default 1)
+//   --save <file>      write the poses of the first run
+//   --compare <file>   diff the first run against poses saved with --save
+#include "libobjecttracker/object_tracker.h"
+#include "libobjecttracker/cloudlog.hpp"
+#include "yaml_config.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace libobjecttracker;
+
+struct RunConfig
+{
+  std::string name;
+  RegistrationBackend backend;
+  MotionModel motionModel;
+};
+
+// per frame, per object
+struct PoseLog
+{
+  std::vector<std::vector<Eigen::Affine3f, Eigen::aligned_allocator<Eigen::Affine3f> > > poses;
+  std::vector<std::vector<bool> > valid;
+};
+
+struct RunResult
+{
+  std::vector<double> frameTimes; // seconds
+  size_t registrations;
+  size_t notConverged;
+  size_t dynamicCheckFailures;
+  size_t validPoses;
+  size_t totalPoses;
+  PoseLog poses;
+};
+
+static RunConfig parseRun(const std::string& spec)
+{
+  RunConfig config;
+  config.name = spec;
+  size_t colon = spec.find(':');
+  std::string backend = spec.substr(0, colon);
+  std::string motion = colon == std::string::npos ? "cv" : spec.substr(colon + 1);
+
+  if (backend == "icp") {
+    config.backend = RegistrationBackendPclICP;
+  } else if (backend == "closedform") {
+    config.backend = RegistrationBackendClosedForm;
+  } else {
+    throw std::runtime_error("unknown backend: " + backend);
+  }
+
+  if (motion == "none") {
+    config.motionModel = MotionModelNone;
+  } else if (motion == "cv") {
+    config.motionModel = MotionModelConstantVelocity;
+  } else if (motion == "kalman") {
+    config.motionModel = MotionModelKalman;
+  } else {
+    throw std::runtime_error("unknown motion model: " + motion);
+  }
+  return config;
+}
+
+static RunResult run(
+  const PointCloudPlayer& player,
+  const RunConfig& config,
+  size_t numThreads,
+  const std::vector<DynamicsConfiguration>& dynamicsConfigurations,
+  const std::vector<MarkerConfiguration>& markerConfigurations,
+  const std::vector<Object>& objects)
+{
+  RunResult r;
+  r.validPoses = 0;
+  r.totalPoses = 0;
+
+  ObjectTracker tracker(dynamicsConfigurations, markerConfigurations, objects);
+  tracker.setNumThreads(numThreads);
+  tracker.setRegistrationBackend(config.backend);
+  tracker.setMotionModel(config.motionModel);
+
+  r.frameTimes.reserve(player.size());
+  for (size_t i = 0; i < player.size(); ++i) {
+    auto start = std::chrono::high_resolution_clock::now();
+    tracker.update(player.stamp(i), player.points(i), player.numPoints(i));
+    auto end = std::chrono::high_resolution_clock::now();
+    r.frameTimes.push_back(std::chrono::duration<double>(end - start).count());
+
+    r.poses.poses.emplace_back();
+    r.poses.valid.emplace_back();
+    for (const auto& object : tracker.objects()) {
+      r.poses.poses.back().push_back(object.transformation());
+      r.poses.valid.back().push_back(object.lastTransformationValid());
+      r.validPoses += object.lastTransformationValid();
+      ++r.totalPoses;
+    }
+  }
+
+  TrackerCounters counters = tracker.counters();
+  r.registrations = counters.registrations;
+  r.notConverged = counters.failedChecks[TrackingCheckConverged];
+  r.dynamicCheckFailures = counters.rejected - r.notConverged;
+  return r;
+}
+
+static double share(size_t count, size_t total)
+{
+  return total > 0 ? 100.0 * count / total : 0;
+}
+
+static void report(const std::string& name, const RunResult& r)
+{
+  std::vector<double> t = r.frameTimes;
+  if (t.empty()) {
+    std::cout << name << ": no frames\n";
+    return;
+  }
+  double sum = 0;
+  for (double v : t) {
+    sum += v;
+  }
+  std::sort(t.begin(), t.end());
+  auto percentile = [&t](double p) {
+    return t[std::min(t.size() - 1, (size_t)(p * t.size()))];
+  };
+
+  std::cout << std::fixed << std::setprecision(1)
+            << name << "\n"
+            << "  latency [us]: mean " << 1e6 * sum / t.size()
+            << ", p50 " << 1e6 * percentile(0.5)
+            << ", p90 " << 1e6 * percentile(0.9)
+            << ", p99 " << 1e6 * percentile(0.99)
+            << ", max " << 1e6 * t.back()
+            << " (" << t.size() / sum << " frames/s)\n"
+            << "  registrations: " << r.registrations
+            << ", converged " << share(r.registrations - r.notConverged, r.registrations) << "%"
+            << ", dynamic check failed " << share(r.dynamicCheckFailures, r.registrations) << "%\n"
+            << "  valid poses: " << r.validPoses << "/" << r.totalPoses
+            << " (" << share(r.validPoses, r.totalPoses) << "%)\n";
+}
+
+// one line per frame and object: frame object valid x y z qw qx qy qz
+static void savePoses(const std::string& path, const PoseLog& log)
+{
+  std::ofstream s(path);
+  if (!s) {
+    throw std::runtime_error("cannot write " + path);
+  }
+  s << std::setprecision(9);
+  for (size_t i = 0; i < log.poses.size(); ++i) {
+    for (size_t j = 0; j < log.poses[i].size(); ++j) {
+      const Eigen::Affine3f& pose = log.poses[i][j];
+      Eigen::Quaternionf q(pose.linear());
+      s << i << " " << j << " " << log.valid[i][j] << " "
+        << pose.translation().x() << " " << pose.translation().y() << " " << pose.translation().z() << " "
+        << q.w() << " " << q.x() << " " << q.y() << " " << q.z() << "\n";
+    }
+  }
+}
+
+static PoseLog loadPoses(const std::string& path)
+{
+  std::ifstream s(path);
+  if (!s) {
+    throw std::runtime_error("cannot read " + path);
+  }
+  PoseLog log;
+  size_t i, j;
+  bool valid;
+  float x, y, z, qw, qx, qy, qz;
+  while (s >> i >> j >> valid >> x >> y >> z >> qw >> qx >> qy >> qz) {
+    if (log.poses.size() <= i) {
+      log.poses.resize(i + 1);
+      log.valid.resize(i + 1);
+    }
+    Eigen::Affine3f pose = Eigen::Translation3f(x, y, z) * Eigen::Quaternionf(qw, qx, qy, qz);
+    log.poses[i].push_back(pose);
+    log.valid[i].push_back(valid);
+  }
+  return log;
+}
+
+static void diff(const std::string& name, const PoseLog& a, const PoseLog& b)
+{
+  size_t const frames = std::min(a.poses.size(), b.poses.size());
+  size_t compared = 0;
+  size_t validityDiffers = 0;
+  double maxTranslation = 0;
+  double maxRotation = 0;
+  size_t worstFrame = 0;
+  for (size_t i = 0; i < frames; ++i) {
+    size_t const objects = std::min(a.poses[i].size(), b.poses[i].size());
+    for (size_t j = 0; j < objects; ++j) {
+      if (a.valid[i][j] != b.valid[i][j]) {
+        ++validityDiffers;
+        continue;
+      }
+      if (!a.valid[i][j]) {
+        continue;
+      }
+      const Eigen::Affine3f& pa = a.poses[i][j];
+      const Eigen::Affine3f& pb = b.poses[i][j];
+      double translation = (pa.translation() - pb.translation()).norm();
+      Eigen::AngleAxisf rotation(pa.linear().transpose() * pb.linear());
+      if (translation > maxTranslation) {
+        maxTranslation = translation;
+        worstFrame = i;
+      }
+      maxRotation = std::max<double>(maxRotation, std::fabs(rotation.angle()));
+      ++compared;
+    }
+  }
+
+  std::cout << std::setprecision(3)
+            << name << ": " << frames << " frames";
+  if (a.poses.size() != b.poses.size()) {
+    std::cout << " (frame counts differ: " << a.poses.size() << " vs " << b.poses.size() << ")";
+  }
+  std::cout << ", validity differs for " << validityDiffers << " poses"
+            << ", " << compared << " poses compared"
+            << ", max translation " << 1e3 * maxTranslation << " mm (frame " << worstFrame << ")"
+            << ", max rotation " << maxRotation * 180.0 / M_PI << " deg\n";
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "error: requires filename argument\n";
+    return -1;
+  }
+
+  std::string logPath = argv[1];
+  std::vector<RunConfig> runs;
+  size_t numThreads = 1;
+  std::string savePath;
+  std::string comparePath;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "error: missing value for " << arg << "\n";
+      return -1;
+    }
+    std::string value = argv[++i];
+    if (arg == "--config") {
+      YAMLDIR = value;
+    } else if (arg == "--run") {
+      runs.push_back(parseRun(value));
+    } else if (arg == "--threads") {
+      numThreads = std::stoul(value);
+    } else if (arg == "--save") {
+      savePath = value;
+    } else if (arg == "--compare") {
+      comparePath = value;
+    } else {
+      std::cerr << "error: unknown option " << arg << "\n";
+      return -1;
+    }
+  }
+  if (runs.empty()) {
+    for (const char* spec : {"icp:none", "icp:cv", "icp:kalman", "closedform:cv"}) {
+      runs.push_back(parseRun(spec));
+    }
+  }
+
+  std::vector<DynamicsConfiguration> dynamicsConfigurations;
+  std::vector<MarkerConfiguration> markerConfigurations;
+  std::vector<Object> objects;
+
+  readMarkerConfigurations(markerConfigurations);
+  readDynamicsConfigurations(dynamicsConfigurations);
+  readObjects(objects);
+
+  PointCloudPlayer player;
+  player.load(logPath);
+  std::cout << player.size() << " frames, " << objects.size() << " objects, "
+            << numThreads << " threads.\n";
+
+  std::vector<RunResult> results;
+  for (const auto& config : runs) {
+    results.push_back(run(player, config, numThreads,
+      dynamicsConfigurations, markerConfigurations, objects));
+    report(config.name, results.back());
+  }
+
+  for (size_t i = 1; i < runs.size(); ++i) {
+    diff(runs[0].name + " vs " + runs[i].name, results[0].poses, results[i].poses);
+  }
+  if (!comparePath.empty()) {
+    diff(runs[0].name + " vs " + comparePath, results[0].poses, loadPoses(comparePath));
+  }
+  if (!savePath.empty()) {
+    savePoses(savePath, results[0].poses);
+  }
+}
@@ -0,0 +1,217 @@
+#pragma once
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/search/kdtree.h>
+
+namespace libobjecttracker {
+
+  // Least-squares rigid transform mapping src[i] onto dst[i] (Kabsch/Horn).
+  inline Eigen::Affine3f estimateRigidTransform(
+    const Eigen::Vector3f* src,
+    const Eigen::Vector3f* dst,
+    int n)
+  {
+    Eigen::Vector3f srcCenter = Eigen::Vector3f::Zero();
+    Eigen::Vector3f dstCenter = Eigen::Vector3f::Zero();
+    for (int i = 0; i < n; ++i) {
+      srcCenter += src[i];
+      dstCenter += dst[i];
+    }
+    srcCenter /= n;
+    dstCenter /= n;
+
+    Eigen::Matrix3f H = Eigen::Matrix3f::Zero();
+    for (int i = 0; i < n; ++i) {
+      H += (src[i] - srcCenter) * (dst[i] - dstCenter).transpose();
+    }
+
+    Eigen::JacobiSVD<Eigen::Matrix3f> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3f V = svd.matrixV();
+    Eigen::Matrix3f R = V * svd.matrixU().transpose();
+    // avoid reflections
+    if (R.determinant() < 0) {
+      V.col(2) *= -1;
+      R = V * svd.matrixU().transpose();
+    }
+
+    Eigen::Affine3f result = Eigen::Affine3f::Identity();
+    result.linear() = R;
+    result.translation() = dstCenter - R * srcCenter;
+    return result;
+  }
+
+  // Registration for objects with only a handful of markers.
+  // Each model marker is matched to its nearest neighbor around the
+  // predicted pose (gated by the max correspondence distance), and the
+  // rigid transform is recovered in closed form (Kabsch/Horn via a 3x3 SVD).
+  // All storage is fixed-size; nothing is allocated per frame once the
+  // knn buffers reached their (tiny) steady-state capacity.
+  class ClosedFormRegistration
+  {
+  public:
+    static const int MaxMarkers = 16;
+
+    ClosedFormRegistration()
+      : m_numModel(0)
+      , m_maxCorrespondenceDistance(0)
+      , m_maxIterations(5)
+      , m_transformation(Eigen::Affine3f::Identity())
+      , m_fitness(0)
+      , m_numCorrespondences(0)
+      , m_iterations(0)
+      , m_converged(false)
+    {
+      m_knnIdx.reserve(1);
+      m_knnSqrDist.reserve(1);
+    }
+
+    // returns false if the model has more than MaxMarkers points
+    bool setModel(const pcl::PointCloud<pcl::PointXYZ>& model)
+    {
+      if (model.size() > MaxMarkers) {
+        return false;
+      }
+      m_numModel = model.size();
+      for (int i = 0; i < m_numModel; ++i) {
+        m_model[i] = Eigen::Vector3f(model[i].x, model[i].y, model[i].z);
+      }
+      return true;
+    }
+
+    void setMaxCorrespondenceDistance(float distance)
+    {
+      m_maxCorrespondenceDistance = distance;
+    }
+
+    void setMaximumIterations(int iterations)
+    {
+      m_maxIterations = iterations;
+    }
+
+    bool align(
+      const pcl::search::KdTree<pcl::PointXYZ>& tree,
+      const pcl::PointCloud<pcl::PointXYZ>& target,
+      const Eigen::Affine3f& guess)
+    {
+      m_converged = false;
+      m_transformation = guess;
+      for (int i = 0; i < m_numModel; ++i) {
+        m_match[i] = -1;
+      }
+
+      for (m_iterations = 0; ; ++m_iterations) {
+        bool changed = findCorrespondences(tree, target);
+        // a rigid transform needs at least 3 points
+        if (m_numCorrespondences < 3) {
+          return false;
+        }
+        if (!changed || m_iterations == m_maxIterations) {
+          break;
+        }
+        m_transformation = estimateRigidTransform(m_src, m_dst, m_numCorrespondences);
+      }
+
+      m_converged = true;
+      return true;
+    }
+
+    bool hasConverged() const
+    {
+      return m_converged;
+    }
+
+    const Eigen::Affine3f& transformation() const
+    {
+      return m_transformation;
+    }
+
+    // mean squared distance of the matched markers (same as PCL's fitness)
+    double fitnessScore() const
+    {
+      return m_fitness;
+    }
+
+    int iterations() const
+    {
+      return m_iterations;
+    }
+
+  private:
+    // returns true if the set of correspondences differs from the last call
+    bool findCorrespondences(
+      const pcl::search::KdTree<pcl::PointXYZ>& tree,
+      const pcl::PointCloud<pcl::PointXYZ>& target)
+    {
+      float const maxSqrDist = m_maxCorrespondenceDistance * m_maxCorrespondenceDistance;
+
+      int match[MaxMarkers];
+      float sqrDist[MaxMarkers];
+      for (int i = 0; i < m_numModel; ++i) {
+        Eigen::Vector3f p = m_transformation * m_model[i];
+        match[i] = -1;
+        if (tree.nearestKSearch(pcl::PointXYZ(p.x(), p.y(), p.z()), 1, m_knnIdx, m_knnSqrDist) == 1
+            && m_knnSqrDist[0] <= maxSqrDist) {
+          match[i] = m_knnIdx[0];
+          sqrDist[i] = m_knnSqrDist[0];
+          // a marker can only belong to one model point; keep the closer one
+          for (int j = 0; j < i; ++j) {
+            if (match[j] == match[i]) {
+              if (sqrDist[j] <= sqrDist[i]) {
+                match[i] = -1;
+              } else {
+                match[j] = -1;
+              }
+              break;
+            }
+          }
+        }
+      }
+
+      bool changed = false;
+      int n = 0;
+      double sum = 0;
+      for (int i = 0; i < m_numModel; ++i) {
+        changed = changed || match[i] != m_match[i];
+        m_match[i] = match[i];
+        if (match[i] >= 0) {
+          const pcl::PointXYZ& t = target[match[i]];
+          m_src[n] = m_model[i];
+          m_dst[n] = Eigen::Vector3f(t.x, t.y, t.z);
+          sum += sqrDist[i];
+          ++n;
+        }
+      }
+      m_numCorrespondences = n;
+      m_fitness = n > 0 ? sum / n : 0;
+      return changed || m_iterations == 0;
+    }
+
+  private:
+    Eigen::Vector3f m_model[MaxMarkers];
+    int m_numModel;
+    float m_maxCorrespondenceDistance;
+    int m_maxIterations;
+
+    Eigen::Affine3f m_transformation;
+    double m_fitness;
+    int m_match[MaxMarkers];
+    Eigen::Vector3f m_src[MaxMarkers];
+    Eigen::Vector3f m_dst[MaxMarkers];
+    int m_numCorrespondences;
+    int m_iterations;
+    bool m_converged;
+
+    // buffers for the kd-tree query, reused between frames
+    std::vector<int> m_knnIdx;
+    std::vector<float> m_knnSqrDist;
+
+  public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+} // namespace libobjecttracker
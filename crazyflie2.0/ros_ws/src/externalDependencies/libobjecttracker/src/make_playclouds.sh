@@ -5,7 +5,7 @@ else
 CC="g++"
 fi
 
-CFLAGS="-g -Wall -std=c++11"
+CFLAGS="-g -Wall -std=c++11 -pthread"
 
 if [ `uname` = "Darwin" ]; then
 LIBS="-I../include/ \
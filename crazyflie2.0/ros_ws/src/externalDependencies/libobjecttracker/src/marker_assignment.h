@@ -0,0 +1,200 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+#include "closed_form_registration.h"
+
+namespace libobjecttracker {
+
+  // Minimum-cost assignment of rows to columns (Hungarian method, O(n^3)).
+  // The matrix may be rectangular. Costs >= infeasible are never used:
+  // rows left without a feasible column are reported as -1.
+  inline void solveAssignment(
+    const Eigen::MatrixXf& cost,
+    float infeasible,
+    std::vector<int>& rowToCol)
+  {
+    int const rows = cost.rows();
+    int const cols = cost.cols();
+    int const n = std::max(rows, cols);
+    // pad to a square matrix; 1-based potentials formulation
+    auto at = [&](int i, int j) -> double {
+      return (i <= rows && j <= cols) ? std::min(cost(i - 1, j - 1), infeasible) : infeasible;
+    };
+
+    std::vector<double> u(n + 1, 0);
+    std::vector<double> v(n + 1, 0);
+    std::vector<int> p(n + 1, 0);
+    std::vector<int> way(n + 1, 0);
+    std::vector<double> minv(n + 1);
+    std::vector<bool> used(n + 1);
+    for (int i = 1; i <= n; ++i) {
+      p[0] = i;
+      int j0 = 0;
+      std::fill(minv.begin(), minv.end(), DBL_MAX);
+      std::fill(used.begin(), used.end(), false);
+      do {
+        used[j0] = true;
+        int i0 = p[j0];
+        int j1 = 0;
+        double delta = DBL_MAX;
+        for (int j = 1; j <= n; ++j) {
+          if (!used[j]) {
+            double cur = at(i0, j) - u[i0] - v[j];
+            if (cur < minv[j]) {
+              minv[j] = cur;
+              way[j] = j0;
+            }
+            if (minv[j] < delta) {
+              delta = minv[j];
+              j1 = j;
+            }
+          }
+        }
+        for (int j = 0; j <= n; ++j) {
+          if (used[j]) {
+            u[p[j]] += delta;
+            v[j] -= delta;
+          } else {
+            minv[j] -= delta;
+          }
+        }
+        j0 = j1;
+      } while (p[j0] != 0);
+      do {
+        int j1 = way[j0];
+        p[j0] = p[j1];
+        j0 = j1;
+      } while (j0);
+    }
+
+    rowToCol.assign(rows, -1);
+    for (int j = 1; j <= cols; ++j) {
+      int i = p[j];
+      if (i >= 1 && i <= rows && cost(i - 1, j - 1) < infeasible) {
+        rowToCol[i - 1] = j - 1;
+      }
+    }
+  }
+
+  // Fits a marker configuration to an unordered set of the same number of
+  // markers without an initial guess. Every marker is described by the
+  // sorted distances to the other markers of its set, which does not
+  // depend on the pose; matching these descriptors gives the point
+  // correspondences, and the pose follows in closed form.
+  class MarkerSetMatcher
+  {
+  public:
+    typedef std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > Points;
+
+    void setModel(const Points& model)
+    {
+      m_model = model;
+      computeDescriptors(m_model, m_modelDescriptors);
+    }
+
+    size_t size() const
+    {
+      return m_model.size();
+    }
+
+    // largest distance between a marker and its nearest neighbor
+    float maxNearestNeighborDistance() const
+    {
+      float result = 0;
+      for (const auto& d : m_modelDescriptors) {
+        if (!d.empty()) {
+          result = std::max(result, d.front());
+        }
+      }
+      return result;
+    }
+
+    // returns the mean squared residual, or FLT_MAX if sizes differ
+    float fit(const Points& markers, Eigen::Affine3f& transformation)
+    {
+      size_t const n = m_model.size();
+      if (markers.size() != n || n < 3) {
+        return FLT_MAX;
+      }
+
+      computeDescriptors(markers, m_descriptors);
+      m_cost.resize(n, n);
+      for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+          float c = 0;
+          for (size_t k = 0; k + 1 < n; ++k) {
+            float d = m_modelDescriptors[i][k] - m_descriptors[j][k];
+            c += d * d;
+          }
+          m_cost(i, j) = c;
+        }
+      }
+
+      // symmetric configurations can produce ambiguous descriptor matches;
+      // re-match on the aligned positions until the correspondences settle
+      static int const MaxIterations = 5;
+      for (int iter = 0; ; ++iter) {
+        solveAssignment(m_cost, FLT_MAX, m_match);
+        m_src.clear();
+        m_dst.clear();
+        for (size_t i = 0; i < n; ++i) {
+          m_src.push_back(m_model[i]);
+          m_dst.push_back(markers[m_match[i]]);
+        }
+        transformation = estimateRigidTransform(m_src.data(), m_dst.data(), static_cast<int>(n));
+
+        bool changed = m_previousMatch != m_match;
+        m_previousMatch = m_match;
+        if (!changed || iter == MaxIterations) {
+          break;
+        }
+        for (size_t i = 0; i < n; ++i) {
+          Eigen::Vector3f p = transformation * m_model[i];
+          for (size_t j = 0; j < n; ++j) {
+            m_cost(i, j) = (p - markers[j]).squaredNorm();
+          }
+        }
+      }
+      m_previousMatch.clear();
+
+      float sum = 0;
+      for (size_t i = 0; i < n; ++i) {
+        sum += (transformation * m_src[i] - m_dst[i]).squaredNorm();
+      }
+      return sum / n;
+    }
+
+  private:
+    static void computeDescriptors(const Points& points, std::vector<std::vector<float> >& descriptors)
+    {
+      descriptors.resize(points.size());
+      for (size_t i = 0; i < points.size(); ++i) {
+        descriptors[i].clear();
+        for (size_t j = 0; j < points.size(); ++j) {
+          if (i != j) {
+            descriptors[i].push_back((points[i] - points[j]).norm());
+          }
+        }
+        std::sort(descriptors[i].begin(), descriptors[i].end());
+      }
+    }
+
+  private:
+    Points m_model;
+    std::vector<std::vector<float> > m_modelDescriptors;
+
+    // scratch space, reused between calls
+    std::vector<std::vector<float> > m_descriptors;
+    Eigen::MatrixXf m_cost;
+    std::vector<int> m_match;
+    std::vector<int> m_previousMatch;
+    Points m_src;
+    Points m_dst;
+  };
+
+} // namespace libobjecttracker
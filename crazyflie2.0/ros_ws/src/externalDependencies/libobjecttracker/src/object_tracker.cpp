@@ -1,4 +1,9 @@
 #include "libobjecttracker/object_tracker.h"
+#include "closed_form_registration.h"
+#include "marker_assignment.h"
+#include "position_filter.h"
+#include "ring_buffer.h"
+#include "thread_pool.h"
 
 // PCL
 #include <pcl/point_cloud.h>
@@ -6,6 +11,7 @@
 #include <pcl/common/transforms.h>
 #include <pcl/registration/icp.h>
 #include <pcl/registration/transformation_estimation_2D.h>
+#include <pcl/search/kdtree.h>
 // #include <pcl/registration/transformation_estimation_lm.h>
 
 // TEMP for debug
@@ -14,6 +20,7 @@
 using Point = pcl::PointXYZ;
 using Cloud = pcl::PointCloud<Point>;
 using ICP = pcl::IterativeClosestPoint<Point, Point>;
+using KdTree = pcl::search::KdTree<Point>;
 
 static Eigen::Vector3f pcl2eig(Point p)
 {
@@ -42,8 +49,13 @@ Object::Object(
   , m_dynamicsConfigurationIdx(dynamicsConfigurationIdx)
   , m_lastTransformation(initialTransformation)
   , m_initialTransformation(initialTransformation)
+  , m_velocity(Eigen::Vector3f::Zero())
+  , m_angularVelocity(Eigen::Vector3f::Zero())
+  , m_velocityValid(false)
   , m_lastValidTransform()
   , m_lastTransformationValid(false)
+  , m_state(TrackingStateInitializing)
+  , m_reacquireCount(0)
 {
 }
 
@@ -64,6 +76,163 @@ bool Object::lastTransformationValid() const
 
 /////////////////////////////////////////////////////////////
 
+// kd-tree over the markers of the current frame. It is built once per
+// update and shared by every correspondence search of that frame. Markers
+// that were assigned to an object during initialization are masked out
+// instead of being erased, so the tree never has to be rebuilt.
+class MarkerIndex
+{
+public:
+  MarkerIndex()
+    : m_tree(new KdTree)
+    , m_markers()
+    , m_taken()
+    , m_numTaken(0)
+  {
+  }
+
+  void build(Cloud::ConstPtr markers)
+  {
+    m_markers = markers;
+    m_tree->setInputCloud(markers);
+    resetTaken();
+  }
+
+  const KdTree::Ptr& tree() const
+  {
+    return m_tree;
+  }
+
+  const Cloud& markers() const
+  {
+    return *m_markers;
+  }
+
+  void resetTaken()
+  {
+    m_taken.assign(m_markers->size(), false);
+    m_numTaken = 0;
+  }
+
+  void take(int idx)
+  {
+    if (!m_taken[idx]) {
+      m_taken[idx] = true;
+      ++m_numTaken;
+    }
+  }
+
+  // k nearest markers that have not been taken yet
+  int nearestAvailableKSearch(
+    const Point& point,
+    int k,
+    std::vector<int>& idx,
+    std::vector<float>& sqrDist) const
+  {
+    // at most m_numTaken of the neighbors can be masked
+    int nFound = m_tree->nearestKSearch(point, k + m_numTaken, idx, sqrDist);
+    int nAvailable = 0;
+    for (int i = 0; i < nFound && nAvailable < k; ++i) {
+      if (!m_taken[idx[i]]) {
+        idx[nAvailable] = idx[i];
+        sqrDist[nAvailable] = sqrDist[i];
+        ++nAvailable;
+      }
+    }
+    idx.resize(nAvailable);
+    sqrDist.resize(nAvailable);
+    return nAvailable;
+  }
+
+  // appends the available markers, grouped into clusters whose members are
+  // linked by chains of markers at most radius apart
+  void availableClusters(float radius, std::vector<std::vector<int> >& clusters) const
+  {
+    std::vector<bool> visited(m_taken);
+    std::vector<int> idx;
+    std::vector<float> sqrDist;
+    for (int seed = 0; seed < (int)m_markers->size(); ++seed) {
+      if (visited[seed]) {
+        continue;
+      }
+      visited[seed] = true;
+      clusters.push_back(std::vector<int>(1, seed));
+      std::vector<int>& cluster = clusters.back();
+      for (size_t i = 0; i < cluster.size(); ++i) {
+        m_tree->radiusSearch((*m_markers)[cluster[i]], radius, idx, sqrDist);
+        for (int j : idx) {
+          if (!visited[j]) {
+            visited[j] = true;
+            cluster.push_back(j);
+          }
+        }
+      }
+    }
+  }
+
+private:
+  KdTree::Ptr m_tree;
+  Cloud::ConstPtr m_markers;
+  std::vector<bool> m_taken;
+  int m_numTaken;
+};
+
+/////////////////////////////////////////////////////////////
+
+// Registration state owned by a single object. Nothing in here is shared,
+// which is what allows objects to be tracked on different threads.
+struct ObjectTrackingContext
+{
+  ICP icp;
+  Cloud result;
+  ClosedFormRegistration closedForm;
+  bool closedFormSupported;
+  PositionFilter filter;
+  MarkerSetMatcher matcher;
+  // initialization scratch space
+  std::vector<Eigen::Affine3f, Eigen::aligned_allocator<Eigen::Affine3f> > candidateTransformations;
+  MarkerSetMatcher::Points candidatePoints;
+  std::vector<int> nearestIdx;
+  std::vector<float> nearestSqrDist;
+  // registered in the current frame
+  bool registered;
+  ObjectDiagnostics diagnostics;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+struct AtomicTrackerCounters
+{
+  std::atomic<uint64_t> frames;
+  std::atomic<uint64_t> registrations;
+  std::atomic<uint64_t> rejected;
+  std::atomic<uint64_t> failedChecks[TrackingCheckCount];
+  std::atomic<uint64_t> lostTracks;
+  std::atomic<uint64_t> initializationFailures;
+  std::atomic<uint64_t> droppedDiagnostics;
+
+  AtomicTrackerCounters()
+    : frames(0)
+    , registrations(0)
+    , rejected(0)
+    , lostTracks(0)
+    , initializationFailures(0)
+    , droppedDiagnostics(0)
+  {
+    for (auto& c : failedChecks) {
+      c = 0;
+    }
+  }
+
+  // only the tracking thread writes
+  static void increment(std::atomic<uint64_t>& c)
+  {
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+/////////////////////////////////////////////////////////////
+
 ObjectTracker::ObjectTracker(
   const std::vector<DynamicsConfiguration>& dynamicsConfigurations,
   const std::vector<MarkerConfiguration>& markerConfigurations,
@@ -71,11 +240,116 @@ ObjectTracker::ObjectTracker(
   : m_markerConfigurations(markerConfigurations)
   , m_dynamicsConfigurations(dynamicsConfigurations)
   , m_objects(objects)
-  , m_initialized(false)
   , m_init_attempts(0)
+  , m_backend(RegistrationBackendPclICP)
+  , m_motionModel(MotionModelConstantVelocity)
+  , m_maxAcceleration(20)
+  , m_minCorrespondenceDistance(0.02)
+  , m_clusterRadius(0)
+  , m_maxInitDeviation(FLT_MAX)
+  , m_coastTimeout(0.25)
+  , m_reacquireFrames(3)
+  , m_contexts()
+  , m_threadPool()
+  , m_markerIndex(new MarkerIndex)
+  , m_frameBuffer(new Cloud)
+  , m_frame(0)
+  , m_counters(new AtomicTrackerCounters)
+  , m_initializationFailing(false)
+  , m_diagnostics()
+  , m_recordAllDiagnostics(false)
   , m_logWarn()
 {
+  for (const auto& object : m_objects) {
+    const MarkerConfiguration& markerConfig = m_markerConfigurations[object.m_markerConfigurationIdx];
+    m_contexts.emplace_back(new ObjectTrackingContext);
+    ObjectTrackingContext& context = *m_contexts.back();
+    context.registered = false;
+    context.diagnostics = ObjectDiagnostics();
+    context.icp.setMaximumIterations(5);
+    context.icp.setInputSource(markerConfig);
+    context.closedForm.setMaximumIterations(5);
+    context.closedFormSupported = context.closedForm.setModel(*markerConfig);
+
+    MarkerSetMatcher::Points model;
+    for (const Point& p : *markerConfig) {
+      model.push_back(pcl2eig(p));
+    }
+    context.matcher.setModel(model);
+    // markers of one object are linked by their nearest-neighbor distances
+    m_clusterRadius = std::max(m_clusterRadius, 1.5f * context.matcher.maxNearestNeighborDistance());
+  }
+
+  // compute the distance between the closest 2 objects in the nominal configuration
+  // we will use this value to limit allowed deviation from nominal positions
+  float closest = FLT_MAX;
+  for (size_t i = 0; i < m_objects.size(); ++i) {
+    auto pi = m_objects[i].initialCenter();
+    for (size_t j = i + 1; j < m_objects.size(); ++j) {
+      float dist = (pi - m_objects[j].initialCenter()).norm();
+      closest = std::min(closest, dist);
+    }
+  }
+  m_maxInitDeviation = closest / 3;
+  setNumThreads(std::max(1u, std::thread::hardware_concurrency()));
+  setPredictionBounds(m_maxAcceleration, m_minCorrespondenceDistance);
+}
+
+ObjectTracker::~ObjectTracker()
+{
+}
+
+void ObjectTracker::setNumThreads(size_t numThreads)
+{
+  m_threadPool.reset(new ThreadPool(std::max<size_t>(numThreads, 1)));
+}
+
+void ObjectTracker::setRegistrationBackend(RegistrationBackend backend)
+{
+  if (backend == RegistrationBackendClosedForm) {
+    for (const auto& context : m_contexts) {
+      if (!context->closedFormSupported) {
+        std::stringstream sstr;
+        sstr << "Closed-form registration supports at most "
+             << ClosedFormRegistration::MaxMarkers << " markers per object";
+        throw std::runtime_error(sstr.str());
+      }
+    }
+  }
+  m_backend = backend;
+}
 
+void ObjectTracker::setMotionModel(MotionModel model)
+{
+  m_motionModel = model;
+  for (size_t i = 0; i < m_objects.size(); ++i) {
+    resetMotion(i);
+  }
+}
+
+void ObjectTracker::setPredictionBounds(float maxAcceleration, float minCorrespondenceDistance)
+{
+  m_maxAcceleration = maxAcceleration;
+  m_minCorrespondenceDistance = minCorrespondenceDistance;
+  for (auto& context : m_contexts) {
+    // treat the acceleration bound as 3 sigma; mocap noise is sub-millimeter
+    context->filter.setNoise(maxAcceleration / 3, 1e-3);
+  }
+}
+
+void ObjectTracker::setTrackLossPolicy(double coastTimeout, int reacquireFrames)
+{
+  m_coastTimeout = coastTimeout;
+  m_reacquireFrames = reacquireFrames;
+}
+
+void ObjectTracker::resetMotion(size_t objectIdx)
+{
+  Object& object = m_objects[objectIdx];
+  object.m_velocity.setZero();
+  object.m_angularVelocity.setZero();
+  object.m_velocityValid = false;
+  m_contexts[objectIdx]->filter.reset();
 }
 
 void ObjectTracker::update(Cloud::Ptr pointCloud)
@@ -89,6 +363,22 @@ void ObjectTracker::update(std::chrono::high_resolution_clock::time_point time,
   runICP(time, pointCloud);
 }
 
+void ObjectTracker::update(std::chrono::high_resolution_clock::time_point time,
+  const float* xyz, size_t numPoints)
+{
+  // PCL's search and registration need their own (padded) point layout;
+  // resizing keeps the capacity of earlier frames
+  Cloud& cloud = *m_frameBuffer;
+  cloud.resize(numPoints);
+  for (size_t i = 0; i < numPoints; ++i) {
+    Point& p = cloud[i];
+    p.x = xyz[3 * i + 0];
+    p.y = xyz[3 * i + 1];
+    p.z = xyz[3 * i + 2];
+  }
+  runICP(time, m_frameBuffer);
+}
+
 const std::vector<Object>& ObjectTracker::objects() const
 {
   return m_objects;
@@ -100,135 +390,253 @@ void ObjectTracker::setLogWarningCallback(
   m_logWarn = logWarn;
 }
 
-bool ObjectTracker::initialize(Cloud::ConstPtr markersConst)
+TrackerCounters ObjectTracker::counters() const
 {
-  if (markersConst->size() == 0) {
-    return false;
+  const AtomicTrackerCounters& c = *m_counters;
+  TrackerCounters result;
+  result.frames = c.frames;
+  result.registrations = c.registrations;
+  result.rejected = c.rejected;
+  for (int i = 0; i < TrackingCheckCount; ++i) {
+    result.failedChecks[i] = c.failedChecks[i];
   }
+  result.lostTracks = c.lostTracks;
+  result.initializationFailures = c.initializationFailures;
+  result.droppedDiagnostics = c.droppedDiagnostics;
+  return result;
+}
 
-  // we need to mutate the cloud by deleting points
-  // once they are assigned to an object
-  Cloud::Ptr markers(new Cloud(*markersConst));
+void ObjectTracker::setDiagnosticsBuffer(size_t capacity, bool recordAll)
+{
+  m_diagnostics.reset(capacity > 0 ? new RingBuffer<ObjectDiagnostics>(capacity) : nullptr);
+  m_recordAllDiagnostics = recordAll;
+}
 
-  size_t const nObjs = m_objects.size();
+bool ObjectTracker::popDiagnostics(ObjectDiagnostics& diagnostics)
+{
+  return m_diagnostics && m_diagnostics->pop(diagnostics);
+}
 
-  ICP icp;
-  icp.setMaximumIterations(5);
-  icp.setInputTarget(markers);
+const ObjectDiagnostics& ObjectTracker::lastDiagnostics(size_t objectIdx) const
+{
+  return m_contexts[objectIdx]->diagnostics;
+}
+
+std::string ObjectTracker::formatDiagnostics(const ObjectDiagnostics& d) const
+{
+  const DynamicsConfiguration& dynConf =
+    m_dynamicsConfigurations[m_objects[d.objectIdx].m_dynamicsConfigurationIdx];
+  auto failed = [&d](TrackingCheck check) {
+    return (d.failedChecks & (1u << check)) != 0;
+  };
+
+  std::stringstream sstr;
+  if (failed(TrackingCheckConverged)) {
+    sstr << "ICP did not converge!" << std::endl;
+  } else if (d.failedChecks) {
+    sstr << "Dynamic check failed" << std::endl;
+    if (failed(TrackingCheckXVelocity)) {
+      sstr << "vx: " << d.velocity[0] << " >= " << dynConf.maxXVelocity << std::endl;
+    }
+    if (failed(TrackingCheckYVelocity)) {
+      sstr << "vy: " << d.velocity[1] << " >= " << dynConf.maxYVelocity << std::endl;
+    }
+    if (failed(TrackingCheckZVelocity)) {
+      sstr << "vz: " << d.velocity[2] << " >= " << dynConf.maxZVelocity << std::endl;
+    }
+    if (failed(TrackingCheckRollRate)) {
+      sstr << "wroll: " << d.rates[0] << " >= " << dynConf.maxRollRate << std::endl;
+    }
+    if (failed(TrackingCheckPitchRate)) {
+      sstr << "wpitch: " << d.rates[1] << " >= " << dynConf.maxPitchRate << std::endl;
+    }
+    if (failed(TrackingCheckYawRate)) {
+      sstr << "wyaw: " << d.rates[2] << " >= " << dynConf.maxYawRate << std::endl;
+    }
+    if (failed(TrackingCheckRoll)) {
+      sstr << "roll: " << d.roll << " >= " << dynConf.maxRoll << std::endl;
+    }
+    if (failed(TrackingCheckPitch)) {
+      sstr << "pitch: " << d.pitch << " >= " << dynConf.maxPitch << std::endl;
+    }
+    if (failed(TrackingCheckFitness)) {
+      sstr << "fitness: " << d.fitness << " >= " << dynConf.maxFitnessScore << std::endl;
+    }
+  }
+  if (d.lostTrack) {
+    sstr << "Lost track of object " << d.objectIdx << std::endl;
+  }
+  return sstr.str();
+}
+
+bool ObjectTracker::acquire(const std::vector<size_t>& pending,
+  std::chrono::high_resolution_clock::time_point stamp)
+{
+  const Cloud& markers = m_markerIndex->markers();
+
+  // objects that were never found are searched for around their nominal
+  // position; lost objects around their last pose, within the distance
+  // they can have traveled since
+  std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > searchCenters;
+  std::vector<float> searchRadii;
+  for (size_t iObj : pending) {
+    const Object& object = m_objects[iObj];
+    if (object.m_state == TrackingStateInitializing) {
+      searchCenters.push_back(object.initialCenter());
+      searchRadii.push_back(m_maxInitDeviation);
+    } else {
+      const DynamicsConfiguration& dynConf = m_dynamicsConfigurations[object.m_dynamicsConfigurationIdx];
+      std::chrono::duration<double> sinceValid = stamp - object.m_lastValidTransform;
+      searchCenters.push_back(object.center());
+      searchRadii.push_back(dynConf.maxXVelocity * sinceValid.count());
+    }
+  }
 
-  // prepare for knn query
+  // candidate marker sets: the markers nearest to each search center,
+  // plus every cluster of nearby markers
+  std::vector<std::vector<int> > candidates;
   std::vector<int> nearestIdx;
   std::vector<float> nearestSqrDist;
-  std::vector<int> objTakePts;
-  pcl::KdTreeFLANN<Point> kdtree;
-  kdtree.setInputCloud(markers);
-
-  // compute the distance between the closest 2 objects in the nominal configuration
-  // we will use this value to limit allowed deviation from nominal positions
-  float closest = FLT_MAX;
-  for (int i = 0; i < nObjs; ++i) {
-    auto pi = m_objects[i].initialCenter();
-    for (int j = i + 1; j < nObjs; ++j) {
-      float dist = (pi - m_objects[j].initialCenter()).norm();
-      closest = std::min(closest, dist);
+  for (size_t row = 0; row < pending.size(); ++row) {
+    size_t const objNpts = m_contexts[pending[row]]->matcher.size();
+    int nFound = m_markerIndex->nearestAvailableKSearch(
+      eig2pcl(searchCenters[row]), objNpts, nearestIdx, nearestSqrDist);
+    if (nFound >= 0 && static_cast<size_t>(nFound) == objNpts) {
+      candidates.push_back(nearestIdx);
     }
   }
-  float const max_deviation = closest / 3;
+  m_markerIndex->availableClusters(m_clusterRadius, candidates);
+  for (auto& candidate : candidates) {
+    std::sort(candidate.begin(), candidate.end());
+  }
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+  // score every object/candidate pairing, objects in parallel
+  float const infeasible = 1e6;
+  Eigen::MatrixXf cost(pending.size(), candidates.size());
+  m_threadPool->parallelFor(pending.size(), [&](size_t row) {
+    size_t const iObj = pending[row];
+    const Object& object = m_objects[iObj];
+    ObjectTrackingContext& context = *m_contexts[iObj];
+    const DynamicsConfiguration& dynConf = m_dynamicsConfigurations[object.m_dynamicsConfigurationIdx];
+    context.candidateTransformations.resize(candidates.size());
+    MarkerSetMatcher::Points& points = context.candidatePoints;
+
+    for (size_t col = 0; col < candidates.size(); ++col) {
+      cost(row, col) = infeasible;
+      const std::vector<int>& candidate = candidates[col];
+      if (candidate.size() != context.matcher.size()) {
+        continue;
+      }
 
-  //printf("Object tracker: limiting distance from nominal position "
-  //  "to %f meters\n", max_deviation);
+      points.clear();
+      Eigen::Vector3f center(0, 0, 0);
+      for (int idx : candidate) {
+        points.push_back(pcl2eig(markers[idx]));
+        center += points.back();
+      }
+      center /= candidate.size();
 
-  bool allFitsGood = true;
-  for (int iObj = 0; iObj < nObjs; ++iObj) {
-    Object& object = m_objects[iObj];
-    Cloud::Ptr &objMarkers =
-      m_markerConfigurations[object.m_markerConfigurationIdx];
-    icp.setInputSource(objMarkers);
-
-    // find the points nearest to the object's nominal position
-    // (initial pos was loaded into lastTransformation from config file)
-    size_t const objNpts = objMarkers->size();
-    nearestIdx.resize(objNpts);
-    nearestSqrDist.resize(objNpts);
-    auto nominalCenter = eig2pcl(object.initialCenter());
-    int nFound = kdtree.nearestKSearch(
-      nominalCenter, objNpts, nearestIdx, nearestSqrDist);
-
-    if (nFound < objNpts) {
-      std::stringstream sstr;
-      sstr << "error: only " << nFound
-           << " neighbors found for object " << iObj
-           << " (need " << objNpts << ")";
-      logWarn(sstr.str());
-      allFitsGood = false;
-      continue;
-    }
+      // only fit markers that are reasonably close to where the object should be
+      float deviation = (center - searchCenters[row]).norm();
+      if (deviation > searchRadii[row]) {
+        continue;
+      }
 
-    // only try to fit the object if the k nearest neighbors
-    // are reasonably close to the nominal object position
-    Eigen::Vector3f actualCenter(0, 0, 0);
-    for (int i = 0; i < objNpts; ++i) {
-      actualCenter += pcl2eig((*markers)[nearestIdx[i]]);
-    }
-    actualCenter /= objNpts;
-    if ((actualCenter - pcl2eig(nominalCenter)).norm() > max_deviation) {
-      std::stringstream sstr;
-      sstr << "error: nearest neighbors of object " << iObj
-           << " are centered at " << actualCenter
-           << " instead of " << nominalCenter;
-      logWarn(sstr.str());
-      allFitsGood = false;
-      continue;
+      float fitness = context.matcher.fit(points, context.candidateTransformations[col]);
+      if (fitness < dynConf.maxFitnessScore) {
+        // identical objects can only be told apart by their positions
+        cost(row, col) = deviation * deviation + fitness;
+      }
     }
-
-    // try ICP with guesses of many different yaws about knn centroid
-    Cloud result;
-    static int const N_YAW = 20;
-    double bestErr = DBL_MAX;
-    Eigen::Affine3f bestTransformation;
-    for (int i = 0; i < N_YAW; ++i) {
-      float yaw = i * (2 * M_PI / N_YAW);
-      Eigen::Matrix4f tryMatrix = pcl::getTransformation(
-        actualCenter.x(), actualCenter.y(), actualCenter.z(),
-        0, 0, yaw).matrix();
-      icp.align(result, tryMatrix);
-      if (icp.hasConverged()) {
-        double err = icp.getFitnessScore();
-        if (err < bestErr) {
-          bestErr = err;
-          bestTransformation = icp.getFinalTransformation();
+  });
+
+  // candidates can share markers: forbid the worse of two overlapping
+  // pairings and solve again until no marker is assigned twice
+  std::vector<int> assignment;
+  std::vector<int> owner(markers.size());
+  bool conflict = true;
+  while (conflict) {
+    solveAssignment(cost, infeasible, assignment);
+    std::fill(owner.begin(), owner.end(), -1);
+    conflict = false;
+    for (size_t row = 0; row < pending.size() && !conflict; ++row) {
+      int col = assignment[row];
+      if (col < 0) {
+        continue;
+      }
+      for (int idx : candidates[col]) {
+        if (owner[idx] >= 0) {
+          size_t other = owner[idx];
+          size_t worse = cost(row, col) > cost(other, assignment[other]) ? row : other;
+          cost(worse, assignment[worse]) = infeasible;
+          conflict = true;
+          break;
         }
+        owner[idx] = row;
       }
     }
+  }
 
-    const DynamicsConfiguration& dynConf = m_dynamicsConfigurations[object.m_dynamicsConfigurationIdx];
-    if (bestErr >= dynConf.maxFitnessScore) {
-      logWarn("Initialize did not succeed (fitness too low).");
+  bool allFitsGood = true;
+  for (size_t row = 0; row < pending.size(); ++row) {
+    size_t const iObj = pending[row];
+    Object& object = m_objects[iObj];
+    int col = assignment[row];
+    if (col < 0 && object.m_state == TrackingStateLost) {
+      // searched for again next frame
+      continue;
+    }
+    if (col < 0) {
+      if (!m_initializationFailing) {
+        std::stringstream sstr;
+        sstr << "error: no markers matching object " << iObj
+             << " found near " << object.initialCenter().transpose();
+        logWarn(sstr.str());
+      }
       allFitsGood = false;
       continue;
     }
 
-    // if the fit was good, this object "takes" the markers, and they become
-    // unavailable to all other objects so we don't double-assign markers
-    // (TODO: this is so greedy... do we need a more global approach?)
-    object.m_lastTransformation = bestTransformation;
-    // remove highest indices first
-    std::sort(objTakePts.rbegin(), objTakePts.rend());
-    for (int idx : objTakePts) {
-      markers->erase(markers->begin() + idx);
+    // the object takes its markers so they are not double-assigned
+    object.m_lastTransformation = m_contexts[iObj]->candidateTransformations[col];
+    if (object.m_state == TrackingStateLost) {
+      object.m_state = TrackingStateReacquiring;
+      object.m_reacquireCount = 0;
+    } else {
+      object.m_state = TrackingStateTracked;
+    }
+    for (int idx : candidates[col]) {
+      m_markerIndex->take(idx);
     }
-    // update search structures after deleting markers
-    icp.setInputTarget(markers);
-    kdtree.setInputCloud(markers);
   }
 
   ++m_init_attempts;
   return allFitsGood;
 }
 
+void ObjectTracker::takeObjectMarkers(size_t objectIdx)
+{
+  const Object& object = m_objects[objectIdx];
+  ObjectTrackingContext& context = *m_contexts[objectIdx];
+  const Cloud& markerConfig = *m_markerConfigurations[object.m_markerConfigurationIdx];
+  float const maxSqrDist = m_minCorrespondenceDistance * m_minCorrespondenceDistance;
+  for (const Point& marker : markerConfig) {
+    Point p = eig2pcl(object.m_lastTransformation * pcl2eig(marker));
+    if (m_markerIndex->tree()->nearestKSearch(p, 1, context.nearestIdx, context.nearestSqrDist) == 1
+        && context.nearestSqrDist[0] <= maxSqrDist) {
+      m_markerIndex->take(context.nearestIdx[0]);
+    }
+  }
+}
+
 void ObjectTracker::runICP(std::chrono::high_resolution_clock::time_point stamp,
   Cloud::ConstPtr markers)
 {
+  ++m_frame;
+  AtomicTrackerCounters::increment(m_counters->frames);
+
   if (markers->empty()) {
     for (auto& object : m_objects) {
       object.m_lastTransformationValid = false;
@@ -236,129 +644,283 @@ void ObjectTracker::runICP(std::chrono::high_resolution_clock::time_point stamp,
     return;
   }
 
-  m_initialized = m_initialized || initialize(markers);
-  if (!m_initialized) {
-    logWarn(
-      "Object tracker initialization failed - "
-      "check that position is correct, all markers are visible, "
-      "and marker configuration matches config file");
-    // Doesn't make too much sense to continue here - lets wait to be fully initialized
-    return;
+  m_markerIndex->build(markers);
+
+  // share the frame's search tree between all objects
+  // instead of letting every ICP rebuild it
+  if (m_backend == RegistrationBackendPclICP) {
+    for (auto& context : m_contexts) {
+      context->icp.setInputTarget(markers);
+      context->icp.setSearchMethodTarget(m_markerIndex->tree(), true);
+    }
   }
 
-  ICP icp;
+  // objects with a track are registered incrementally; a lost object never
+  // holds up the others
+  m_threadPool->parallelFor(m_objects.size(), [&](size_t i) {
+    TrackingState state = m_objects[i].m_state;
+    if (state == TrackingStateInitializing || state == TrackingStateLost) {
+      m_objects[i].m_lastTransformationValid = false;
+      m_contexts[i]->registered = false;
+    } else {
+      trackObject(i, stamp);
+    }
+  });
+
+  // the remaining objects are searched for among the markers
+  // that the registered objects did not claim
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < m_objects.size(); ++i) {
+    TrackingState state = m_objects[i].m_state;
+    if (state == TrackingStateInitializing || state == TrackingStateLost) {
+      pending.push_back(i);
+    }
+  }
+  if (pending.empty()) {
+    m_initializationFailing = false;
+  } else {
+    for (size_t i = 0; i < m_objects.size(); ++i) {
+      TrackingState state = m_objects[i].m_state;
+      if (state == TrackingStateTracked || state == TrackingStateReacquiring) {
+        takeObjectMarkers(i);
+      }
+    }
+
+    if (!acquire(pending, stamp)) {
+      AtomicTrackerCounters::increment(m_counters->initializationFailures);
+      if (!m_initializationFailing) {
+        logWarn(
+          "Object tracker initialization failed - "
+          "check that position is correct, all markers are visible, "
+          "and marker configuration matches config file");
+        m_initializationFailing = true;
+      }
+    } else {
+      m_initializationFailing = false;
+    }
+
+    // start registering the objects that were just found
+    pending.erase(std::remove_if(pending.begin(), pending.end(),
+      [this](size_t i) {
+        TrackingState state = m_objects[i].m_state;
+        return state == TrackingStateInitializing || state == TrackingStateLost;
+      }), pending.end());
+    for (size_t i : pending) {
+      // poses jumped from the nominal or last known configuration
+      resetMotion(i);
+    }
+    m_threadPool->parallelFor(pending.size(), [&](size_t k) {
+      trackObject(pending[k], stamp);
+    });
+  }
+
+  // bookkeeping in object order, so nothing depends on thread scheduling;
+  // no text is formatted for regular registration failures
+  AtomicTrackerCounters& counters = *m_counters;
+  for (size_t i = 0; i < m_objects.size(); ++i) {
+    ObjectTrackingContext& context = *m_contexts[i];
+    if (!context.registered) {
+      continue;
+    }
+    ObjectDiagnostics& diagnostics = context.diagnostics;
+    diagnostics.state = m_objects[i].m_state;
+
+    AtomicTrackerCounters::increment(counters.registrations);
+    if (diagnostics.failedChecks) {
+      AtomicTrackerCounters::increment(counters.rejected);
+      for (int check = 0; check < TrackingCheckCount; ++check) {
+        if (diagnostics.failedChecks & (1u << check)) {
+          AtomicTrackerCounters::increment(counters.failedChecks[check]);
+        }
+      }
+    }
+    if (diagnostics.lostTrack) {
+      AtomicTrackerCounters::increment(counters.lostTracks);
+      logWarn("Lost track of object " + std::to_string(i));
+    }
+    if (m_diagnostics && (m_recordAllDiagnostics || diagnostics.failedChecks)) {
+      if (!m_diagnostics->push(diagnostics)) {
+        AtomicTrackerCounters::increment(counters.droppedDiagnostics);
+      }
+    }
+  }
+}
+
+void ObjectTracker::trackObject(size_t objectIdx,
+  std::chrono::high_resolution_clock::time_point stamp)
+{
+  Object& object = m_objects[objectIdx];
+  ObjectTrackingContext& context = *m_contexts[objectIdx];
+  ObjectDiagnostics& diagnostics = context.diagnostics;
+  diagnostics = ObjectDiagnostics();
+  diagnostics.frame = m_frame;
+  diagnostics.stamp = stamp;
+  diagnostics.objectIdx = objectIdx;
+  context.registered = true;
+
   // pcl::registration::TransformationEstimationLM<Point, Point>::Ptr trans(new pcl::registration::TransformationEstimationLM<Point, Point>);
   // pcl::registration::TransformationEstimation2D<Point, Point>::Ptr trans(new pcl::registration::TransformationEstimation2D<Point, Point>);
   // pcl::registration::TransformationEstimation3DYaw<Point, Point>::Ptr trans(new pcl::registration::TransformationEstimation3DYaw<Point, Point>);
   // icp.setTransformationEstimation(trans);
 
-
-  // // Set the maximum number of iterations (criterion 1)
-  icp.setMaximumIterations(5);
   // // Set the transformation epsilon (criterion 2)
   // icp.setTransformationEpsilon(1e-8);
   // // Set the euclidean distance difference epsilon (criterion 3)
   // icp.setEuclideanFitnessEpsilon(1);
 
-  icp.setInputTarget(markers);
-
-  for (auto& object : m_objects) {
-    object.m_lastTransformationValid = false;
-
-    std::chrono::duration<double> elapsedSeconds = stamp-object.m_lastValidTransform;
-    double dt = elapsedSeconds.count();
+  bool const previousValid = object.m_lastTransformationValid;
+  object.m_lastTransformationValid = false;
+
+  std::chrono::duration<double> elapsedSeconds = stamp-object.m_lastValidTransform;
+  double dt = elapsedSeconds.count();
+  diagnostics.dt = dt;
+
+  // Set the max correspondence distance
+  // TODO: take max here?
+  const DynamicsConfiguration& dynConf = m_dynamicsConfigurations[object.m_dynamicsConfigurationIdx];
+  float maxV = dynConf.maxXVelocity;
+  float maxCorrespondenceDistance = maxV * dt;
+  // ROS_INFO("max: %f", maxV * dt);
+
+  // Perform the alignment
+  auto predictTransform = predictTransformation(objectIdx, dt, maxCorrespondenceDistance);
+  bool converged;
+  double fitness;
+  Eigen::Matrix4f transformation;
+  if (m_backend == RegistrationBackendClosedForm) {
+    ClosedFormRegistration& reg = context.closedForm;
+    reg.setMaxCorrespondenceDistance(maxCorrespondenceDistance);
+    converged = reg.align(*m_markerIndex->tree(), m_markerIndex->markers(), predictTransform);
+    fitness = reg.fitnessScore();
+    transformation = reg.transformation().matrix();
+  } else {
+    ICP& icp = context.icp;
+    icp.setMaxCorrespondenceDistance(maxCorrespondenceDistance);
+    icp.align(context.result, predictTransform.matrix());
+    converged = icp.hasConverged();
+    fitness = converged ? icp.getFitnessScore() : 0;
+    // Obtain the transformation that aligned cloud_source to cloud_source_registered
+    transformation = icp.getFinalTransformation();
+  }
+  if (!converged) {
+    // ros::Time t = ros::Time::now();
+    // ROS_INFO("ICP did not converge %d.%d", t.sec, t.nsec);
+    diagnostics.failedChecks = 1u << TrackingCheckConverged;
+    trackingFailed(objectIdx, stamp);
+    return;
+  }
 
-    // Set the max correspondence distance
-    // TODO: take max here?
-    const DynamicsConfiguration& dynConf = m_dynamicsConfigurations[object.m_dynamicsConfigurationIdx];
-    float maxV = dynConf.maxXVelocity;
-    icp.setMaxCorrespondenceDistance(maxV * dt);
-    // ROS_INFO("max: %f", maxV * dt);
-
-    // Update input source
-    icp.setInputSource(m_markerConfigurations[object.m_markerConfigurationIdx]);
-
-    // Perform the alignment
-    Cloud result;
-    // auto deltaPos = Eigen::Translation3f(dt * object.m_velocity);
-    // auto predictTransform = deltaPos * object.m_lastTransformation;
-    auto predictTransform = object.m_lastTransformation;
-    icp.align(result, predictTransform.matrix());
-    if (!icp.hasConverged()) {
-      // ros::Time t = ros::Time::now();
-      // ROS_INFO("ICP did not converge %d.%d", t.sec, t.nsec);
-      logWarn("ICP did not converge!");
-      continue;
+  Eigen::Affine3f tROTA(transformation);
+  float x, y, z, roll, pitch, yaw;
+  pcl::getTranslationAndEulerAngles(tROTA, x, y, z, roll, pitch, yaw);
+
+  // Compute changes:
+  float last_x, last_y, last_z, last_roll, last_pitch, last_yaw;
+  pcl::getTranslationAndEulerAngles(object.m_lastTransformation, last_x, last_y, last_z, last_roll, last_pitch, last_yaw);
+
+  float vx = (x - last_x) / dt;
+  float vy = (y - last_y) / dt;
+  float vz = (z - last_z) / dt;
+  float wroll = deltaAngle(roll, last_roll) / dt;
+  float wpitch = deltaAngle(pitch, last_pitch) / dt;
+  float wyaw = deltaAngle(yaw, last_yaw) / dt;
+
+  // ROS_INFO("v: %f,%f,%f, w: %f,%f,%f, dt: %f", vx, vy, vz, wroll, wpitch, wyaw, dt);
+
+  diagnostics.fitness = fitness;
+  diagnostics.velocity[0] = vx;
+  diagnostics.velocity[1] = vy;
+  diagnostics.velocity[2] = vz;
+  diagnostics.rates[0] = wroll;
+  diagnostics.rates[1] = wpitch;
+  diagnostics.rates[2] = wyaw;
+  diagnostics.roll = roll;
+  diagnostics.pitch = pitch;
+  // written as "passed" so that NaNs fail
+  auto check = [&diagnostics](TrackingCheck check, bool passed) {
+    if (!passed) {
+      diagnostics.failedChecks |= 1u << check;
     }
-
-    // Obtain the transformation that aligned cloud_source to cloud_source_registered
-    Eigen::Matrix4f transformation = icp.getFinalTransformation();
-
-    Eigen::Affine3f tROTA(transformation);
-    float x, y, z, roll, pitch, yaw;
-    pcl::getTranslationAndEulerAngles(tROTA, x, y, z, roll, pitch, yaw);
-
-    // Compute changes:
-    float last_x, last_y, last_z, last_roll, last_pitch, last_yaw;
-    pcl::getTranslationAndEulerAngles(object.m_lastTransformation, last_x, last_y, last_z, last_roll, last_pitch, last_yaw);
-
-    float vx = (x - last_x) / dt;
-    float vy = (y - last_y) / dt;
-    float vz = (z - last_z) / dt;
-    float wroll = deltaAngle(roll, last_roll) / dt;
-    float wpitch = deltaAngle(pitch, last_pitch) / dt;
-    float wyaw = deltaAngle(yaw, last_yaw) / dt;
-
-    // ROS_INFO("v: %f,%f,%f, w: %f,%f,%f, dt: %f", vx, vy, vz, wroll, wpitch, wyaw, dt);
-
-    if (   fabs(vx) < dynConf.maxXVelocity
-        && fabs(vy) < dynConf.maxYVelocity
-        && fabs(vz) < dynConf.maxZVelocity
-        && fabs(wroll) < dynConf.maxRollRate
-        && fabs(wpitch) < dynConf.maxPitchRate
-        && fabs(wyaw) < dynConf.maxYawRate
-        && fabs(roll) < dynConf.maxRoll
-        && fabs(pitch) < dynConf.maxPitch
-        && icp.getFitnessScore() < dynConf.maxFitnessScore)
-    {
+  };
+  check(TrackingCheckXVelocity, fabs(vx) < dynConf.maxXVelocity);
+  check(TrackingCheckYVelocity, fabs(vy) < dynConf.maxYVelocity);
+  check(TrackingCheckZVelocity, fabs(vz) < dynConf.maxZVelocity);
+  check(TrackingCheckRollRate, fabs(wroll) < dynConf.maxRollRate);
+  check(TrackingCheckPitchRate, fabs(wpitch) < dynConf.maxPitchRate);
+  check(TrackingCheckYawRate, fabs(wyaw) < dynConf.maxYawRate);
+  check(TrackingCheckRoll, fabs(roll) < dynConf.maxRoll);
+  check(TrackingCheckPitch, fabs(pitch) < dynConf.maxPitch);
+  check(TrackingCheckFitness, fitness < dynConf.maxFitnessScore);
+
+  if (diagnostics.failedChecks == 0)
+  {
+    Eigen::AngleAxisf deltaRotation(
+      tROTA.linear() * object.m_lastTransformation.linear().transpose());
+    object.m_angularVelocity = deltaRotation.axis() * deltaRotation.angle() / dt;
+    if (m_motionModel == MotionModelKalman) {
+      context.filter.update(dt, tROTA.translation());
+      object.m_velocity = context.filter.velocity();
+    } else {
       object.m_velocity = (tROTA.translation() - object.center()) / dt;
-      object.m_lastTransformation = tROTA;
-      object.m_lastValidTransform = stamp;
+    }
+    // differences across dropped frames are not trusted for prediction
+    object.m_velocityValid = previousValid;
+    object.m_lastTransformation = tROTA;
+    object.m_lastValidTransform = stamp;
+    // a reacquired object could have picked up stray markers;
+    // only report it once it was followed for a few frames
+    if (object.m_state != TrackingStateReacquiring
+        || ++object.m_reacquireCount >= m_reacquireFrames) {
+      object.m_state = TrackingStateTracked;
       object.m_lastTransformationValid = true;
-    } else {
-      std::stringstream sstr;
-      sstr << "Dynamic check failed" << std::endl;
-      if (fabs(vx) >= dynConf.maxXVelocity) {
-        sstr << "vx: " << vx << " >= " << dynConf.maxXVelocity << std::endl;
-      }
-      if (fabs(vy) >= dynConf.maxYVelocity) {
-        sstr << "vy: " << vy << " >= " << dynConf.maxYVelocity << std::endl;
-      }
-      if (fabs(vz) >= dynConf.maxZVelocity) {
-        sstr << "vz: " << vz << " >= " << dynConf.maxZVelocity << std::endl;
-      }
-      if (fabs(wroll) >= dynConf.maxRollRate) {
-        sstr << "wroll: " << wroll << " >= " << dynConf.maxRollRate << std::endl;
-      }
-      if (fabs(wpitch) >= dynConf.maxPitchRate) {
-        sstr << "wpitch: " << wpitch << " >= " << dynConf.maxPitchRate << std::endl;
-      }
-      if (fabs(wyaw) >= dynConf.maxYawRate) {
-        sstr << "wyaw: " << wyaw << " >= " << dynConf.maxYawRate << std::endl;
-      }
-      if (fabs(roll) >= dynConf.maxRoll) {
-        sstr << "roll: " << roll << " >= " << dynConf.maxRoll << std::endl;
-      }
-      if (fabs(pitch) >= dynConf.maxPitch) {
-        sstr << "pitch: " << pitch << " >= " << dynConf.maxPitch << std::endl;
-      }
-      if (icp.getFitnessScore() >= dynConf.maxFitnessScore) {
-        sstr << "fitness: " << icp.getFitnessScore() << " >= " << dynConf.maxFitnessScore << std::endl;
-      }
-      logWarn(sstr.str());
     }
+  } else {
+    trackingFailed(objectIdx, stamp);
   }
+}
+
+void ObjectTracker::trackingFailed(size_t objectIdx,
+  std::chrono::high_resolution_clock::time_point stamp)
+{
+  Object& object = m_objects[objectIdx];
+  std::chrono::duration<double> sinceValid = stamp - object.m_lastValidTransform;
+  if (object.m_state == TrackingStateReacquiring
+      || sinceValid.count() > m_coastTimeout) {
+    m_contexts[objectIdx]->diagnostics.lostTrack = object.m_state != TrackingStateLost;
+    object.m_state = TrackingStateLost;
+  } else {
+    object.m_state = TrackingStateCoasting;
+  }
+}
 
+Eigen::Affine3f ObjectTracker::predictTransformation(size_t objectIdx, float dt,
+  float& maxCorrespondenceDistance) const
+{
+  const Object& object = m_objects[objectIdx];
+  if (m_motionModel == MotionModelNone || !object.m_velocityValid) {
+    return object.m_lastTransformation;
+  }
+
+  Eigen::Affine3f predicted = object.m_lastTransformation;
+  float angle = object.m_angularVelocity.norm() * dt;
+  if (angle > 0) {
+    predicted.linear() = Eigen::AngleAxisf(angle, object.m_angularVelocity.normalized())
+      * predicted.linear();
+  }
+
+  float uncertainty;
+  if (m_motionModel == MotionModelKalman) {
+    const PositionFilter& filter = m_contexts[objectIdx]->filter;
+    predicted.translation() = filter.predictPosition(dt);
+    uncertainty = 3 * filter.predictPositionStdDev(dt);
+  } else {
+    predicted.translation() += dt * object.m_velocity;
+    // how far the object can have accelerated away from the prediction
+    uncertainty = 0.5f * m_maxAcceleration * dt * dt;
+  }
+  maxCorrespondenceDistance = std::min(maxCorrespondenceDistance,
+    m_minCorrespondenceDistance + uncertainty);
+  return predicted;
 }
 
 void ObjectTracker::logWarn(const std::string& msg)
@@ -0,0 +1,111 @@
+#pragma once
+#include <cmath>
+
+#include <Eigen/Dense>
+
+namespace libobjecttracker {
+
+  // Constant-velocity Kalman filter on an object's position.
+  // Each axis is an independent (position, velocity) filter; since all axes
+  // share dt and noise, they also share one 2x2 covariance.
+  class PositionFilter
+  {
+  public:
+    PositionFilter()
+      : m_position(Eigen::Vector3f::Zero())
+      , m_velocity(Eigen::Vector3f::Zero())
+      , m_covariance(Eigen::Matrix2f::Zero())
+      , m_accelerationVariance(1)
+      , m_measurementVariance(1e-6)
+      , m_initialized(false)
+    {
+    }
+
+    // standard deviations of the acceleration (m/s^2, process noise)
+    // and of a measured position (m)
+    void setNoise(float accelerationStdDev, float measurementStdDev)
+    {
+      m_accelerationVariance = accelerationStdDev * accelerationStdDev;
+      m_measurementVariance = measurementStdDev * measurementStdDev;
+    }
+
+    void reset()
+    {
+      m_initialized = false;
+      m_velocity.setZero();
+    }
+
+    bool initialized() const
+    {
+      return m_initialized;
+    }
+
+    // state dt seconds after the last update; the filter itself is unchanged
+    Eigen::Vector3f predictPosition(float dt) const
+    {
+      return m_position + dt * m_velocity;
+    }
+
+    // standard deviation of the predicted position along each axis
+    float predictPositionStdDev(float dt) const
+    {
+      return std::sqrt(predictCovariance(dt)(0, 0));
+    }
+
+    void update(float dt, const Eigen::Vector3f& measurement)
+    {
+      if (!m_initialized) {
+        // (m/s)^2, before the first velocity has been observed
+        float const unknownVelocityVariance = 4.0f;
+        m_position = measurement;
+        m_velocity.setZero();
+        m_covariance << m_measurementVariance, 0,
+                        0, unknownVelocityVariance;
+        m_initialized = true;
+        return;
+      }
+
+      Eigen::Matrix2f P = predictCovariance(dt);
+      Eigen::Vector3f position = predictPosition(dt);
+
+      // H = [1 0]
+      float S = P(0, 0) + m_measurementVariance;
+      Eigen::Vector2f K = P.col(0) / S;
+      Eigen::Vector3f innovation = measurement - position;
+      m_position = position + K(0) * innovation;
+      m_velocity += K(1) * innovation;
+      m_covariance = P - K * P.row(0);
+    }
+
+    const Eigen::Vector3f& velocity() const
+    {
+      return m_velocity;
+    }
+
+  private:
+    Eigen::Matrix2f predictCovariance(float dt) const
+    {
+      Eigen::Matrix2f F;
+      F << 1, dt,
+           0, 1;
+      // white-noise acceleration
+      float dt2 = dt * dt;
+      Eigen::Matrix2f Q;
+      Q << dt2 * dt2 / 4, dt2 * dt / 2,
+           dt2 * dt / 2,  dt2;
+      return F * m_covariance * F.transpose() + m_accelerationVariance * Q;
+    }
+
+  private:
+    Eigen::Vector3f m_position;
+    Eigen::Vector3f m_velocity;
+    Eigen::Matrix2f m_covariance;
+    float m_accelerationVariance;
+    float m_measurementVariance;
+    bool m_initialized;
+
+  public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+} // namespace libobjecttracker
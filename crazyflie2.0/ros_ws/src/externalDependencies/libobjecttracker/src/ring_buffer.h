@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <vector>
+
+namespace libobjecttracker {
+
+  // Bounded single-producer/single-consumer queue. push() and pop() are
+  // wait-free and never allocate; push() fails if the buffer is full.
+  template <typename T>
+  class RingBuffer
+  {
+  public:
+    explicit RingBuffer(size_t capacity)
+      : m_buffer(capacity + 1)
+      , m_head(0)
+      , m_tail(0)
+    {
+    }
+
+    bool push(const T& t)
+    {
+      size_t head = m_head.load(std::memory_order_relaxed);
+      size_t next = (head + 1) % m_buffer.size();
+      if (next == m_tail.load(std::memory_order_acquire)) {
+        return false;
+      }
+      m_buffer[head] = t;
+      m_head.store(next, std::memory_order_release);
+      return true;
+    }
+
+    bool pop(T& t)
+    {
+      size_t tail = m_tail.load(std::memory_order_relaxed);
+      if (tail == m_head.load(std::memory_order_acquire)) {
+        return false;
+      }
+      t = m_buffer[tail];
+      m_tail.store((tail + 1) % m_buffer.size(), std::memory_order_release);
+      return true;
+    }
+
+  private:
+    std::vector<T> m_buffer;
+    // next slot to write, owned by the producer
+    std::atomic<size_t> m_head;
+    // next slot to read, owned by the consumer
+    std::atomic<size_t> m_tail;
+  };
+
+} // namespace libobjecttracker
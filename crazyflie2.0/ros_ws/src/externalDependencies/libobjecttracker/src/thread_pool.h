@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace libobjecttracker {
+
+  // Minimal fixed-size pool used to fan out per-object work within a frame.
+  // parallelFor() blocks until every index has been processed, so callers
+  // can treat it as a drop-in replacement for a serial for loop.
+  class ThreadPool
+  {
+  public:
+    explicit ThreadPool(size_t numThreads)
+      : m_fn(nullptr)
+      , m_count(0)
+      , m_next(0)
+      , m_busy(0)
+      , m_generation(0)
+      , m_stop(false)
+    {
+      // the calling thread participates as well
+      for (size_t i = 1; i < numThreads; ++i) {
+        m_threads.emplace_back(&ThreadPool::worker, this);
+      }
+    }
+
+    ~ThreadPool()
+    {
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_cvWork.notify_all();
+      for (auto& t : m_threads) {
+        t.join();
+      }
+    }
+
+    size_t size() const
+    {
+      return m_threads.size() + 1;
+    }
+
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn)
+    {
+      if (m_threads.empty() || count < 2) {
+        for (size_t i = 0; i < count; ++i) {
+          fn(i);
+        }
+        return;
+      }
+
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_fn = &fn;
+        m_count = count;
+        m_next = 0;
+        m_busy = m_threads.size();
+        ++m_generation;
+      }
+      m_cvWork.notify_all();
+
+      process();
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cvDone.wait(lock, [this] { return m_busy == 0; });
+      m_fn = nullptr;
+    }
+
+  private:
+    void process()
+    {
+      for (size_t i = m_next++; i < m_count; i = m_next++) {
+        (*m_fn)(i);
+      }
+    }
+
+    void worker()
+    {
+      uint64_t generation = 0;
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(m_mutex);
+          m_cvWork.wait(lock, [&] { return m_stop || m_generation != generation; });
+          if (m_stop) {
+            return;
+          }
+          generation = m_generation;
+        }
+
+        process();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (--m_busy == 0) {
+          m_cvDone.notify_one();
+        }
+      }
+    }
+
+  private:
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_cvWork;
+    std::condition_variable m_cvDone;
+    const std::function<void(size_t)>* m_fn;
+    size_t m_count;
+    std::atomic<size_t> m_next;
+    size_t m_busy;
+    uint64_t m_generation;
+    bool m_stop;
+  };
+
+} // namespace libobjecttracker